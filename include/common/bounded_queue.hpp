@@ -0,0 +1,81 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+namespace clutils {
+
+// Blocking FIFO between a producer and a consumer thread. push() waits while the queue is full, which keeps a fast
+// producer at most `capacity` items ahead. The producer ends the stream with close(), or with fail() to hand an
+// exception over to the consumer, where pop() rethrows it once the items queued before it are taken.
+template <typename T> class bounded_queue {
+  std::deque<T> m_items;
+  std::size_t m_capacity;
+  bool m_closed = false;
+  std::exception_ptr m_error;
+
+  std::mutex m_mutex;
+  std::condition_variable m_not_full, m_not_empty;
+
+public:
+  explicit bounded_queue(std::size_t capacity) : m_capacity{capacity ? capacity : 1} {}
+
+  // Returns false if the queue was closed meanwhile and the item is dropped
+  bool push(T item) {
+    std::unique_lock lock{m_mutex};
+    m_not_full.wait(lock, [this] { return m_closed || m_items.size() < m_capacity; });
+    if (m_closed) return false;
+
+    m_items.push_back(std::move(item));
+    m_not_empty.notify_one();
+    return true;
+  }
+
+  // Empty once the stream has ended
+  std::optional<T> pop() {
+    std::unique_lock lock{m_mutex};
+    m_not_empty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+
+    if (m_items.empty()) {
+      if (m_error) std::rethrow_exception(m_error);
+      return std::nullopt;
+    }
+
+    auto item = std::move(m_items.front());
+    m_items.pop_front();
+    m_not_full.notify_one();
+    return item;
+  }
+
+  void close() {
+    std::lock_guard lock{m_mutex};
+    m_closed = true;
+    m_not_full.notify_all();
+    m_not_empty.notify_all();
+  }
+
+  void fail(std::exception_ptr error) {
+    std::lock_guard lock{m_mutex};
+    m_error = std::move(error);
+    m_closed = true;
+    m_not_full.notify_all();
+    m_not_empty.notify_all();
+  }
+};
+
+} // namespace clutils
@@ -0,0 +1,159 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "opencl_include.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+namespace clutils {
+
+// Pool of device buffers bound to a single context. Requests are rounded up to power of two size classes and served
+// from free lists. On a miss a sub-buffer is carved out of the current arena, so that the device only sees a handful
+// of large allocations; requests bigger than half an arena get a dedicated buffer of their own size, rounded only to
+// the alignment, since doubling them could exceed the device allocation limit. Released buffers go back to the free
+// list of their class and are never returned to the device, so a steady stream of similar jobs allocates nothing.
+class buffer_pool {
+public:
+  static constexpr std::size_t default_arena_size = std::size_t{256} << 20;
+
+  struct statistics {
+    std::size_t requests = 0, hits = 0;
+    std::size_t device_allocations = 0, device_bytes = 0; // Arenas and dedicated buffers
+    std::size_t in_use = 0, peak_in_use = 0;              // Bytes handed out, rounded to size classes
+
+    double hit_rate() const { return requests ? static_cast<double>(hits) / requests : 0; }
+  };
+
+  // Returns the buffer to the pool when destroyed
+  class handle {
+    buffer_pool *m_pool = nullptr;
+    cl::Buffer m_buffer;
+    std::size_t m_size_class = 0;
+
+  public:
+    handle() = default;
+    handle(buffer_pool *pool, cl::Buffer buffer, std::size_t size_class)
+        : m_pool{pool}, m_buffer{std::move(buffer)}, m_size_class{size_class} {}
+
+    handle(const handle &) = delete;
+    handle &operator=(const handle &) = delete;
+
+    handle(handle &&rhs) noexcept
+        : m_pool{std::exchange(rhs.m_pool, nullptr)}, m_buffer{std::move(rhs.m_buffer)},
+          m_size_class{rhs.m_size_class} {}
+
+    handle &operator=(handle &&rhs) noexcept {
+      std::swap(m_pool, rhs.m_pool);
+      std::swap(m_buffer, rhs.m_buffer);
+      std::swap(m_size_class, rhs.m_size_class);
+      return *this;
+    }
+
+    ~handle() {
+      if (m_pool) m_pool->release(std::move(m_buffer), m_size_class);
+    }
+
+    const cl::Buffer &buffer() const { return m_buffer; }
+    operator const cl::Buffer &() const { return m_buffer; }
+    std::size_t capacity() const { return m_size_class; }
+  };
+
+private:
+  cl::Context m_context;
+  std::size_t m_alignment, m_arena_size;
+
+  std::vector<cl::Buffer> m_arenas;
+  std::size_t m_arena_offset = 0; // Bump pointer into the last arena
+
+  std::map<std::size_t, std::vector<cl::Buffer>> m_free;
+  statistics m_stats;
+  std::mutex m_mutex;
+
+  std::size_t size_class(std::size_t size) const {
+    if (size > m_arena_size / 2) return (size + m_alignment - 1) / m_alignment * m_alignment;
+    return std::max(std::bit_ceil(size), m_alignment);
+  }
+
+  cl::Buffer allocate(std::size_t size_class) {
+    if (size_class > m_arena_size / 2) {
+      ++m_stats.device_allocations;
+      m_stats.device_bytes += size_class;
+      return cl::Buffer{m_context, CL_MEM_READ_WRITE, size_class};
+    }
+
+    if (m_arenas.empty() || m_arena_offset + size_class > m_arena_size) {
+      m_arenas.emplace_back(m_context, CL_MEM_READ_WRITE, m_arena_size);
+      m_arena_offset = 0;
+      ++m_stats.device_allocations;
+      m_stats.device_bytes += m_arena_size;
+    }
+
+    // Size classes are powers of two not smaller than the alignment, so every offset stays aligned
+    const cl_buffer_region region{m_arena_offset, size_class};
+    m_arena_offset += size_class;
+    return m_arenas.back().createSubBuffer(CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION, &region);
+  }
+
+  void release(cl::Buffer buffer, std::size_t size_class) {
+    std::lock_guard lock{m_mutex};
+    m_free[size_class].push_back(std::move(buffer));
+    m_stats.in_use -= size_class;
+  }
+
+public:
+  buffer_pool(cl::Context context, const cl::Device &device, std::size_t arena_size = default_arena_size)
+      : m_context{std::move(context)},
+        m_alignment{std::max<std::size_t>(device.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>() / 8, 256)},
+        m_arena_size{std::min<std::size_t>(arena_size, device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>())} {}
+
+  buffer_pool(const buffer_pool &) = delete;
+  buffer_pool &operator=(const buffer_pool &) = delete;
+
+  handle acquire(std::size_t size) {
+    std::lock_guard lock{m_mutex};
+    const auto cls = size_class(std::max<std::size_t>(size, 1));
+    ++m_stats.requests;
+
+    cl::Buffer buffer;
+    if (auto &free = m_free[cls]; !free.empty()) {
+      ++m_stats.hits;
+      buffer = std::move(free.back());
+      free.pop_back();
+    } else {
+      buffer = allocate(cls);
+    }
+
+    m_stats.in_use += cls;
+    m_stats.peak_in_use = std::max(m_stats.peak_in_use, m_stats.in_use);
+    return handle{this, std::move(buffer), cls};
+  }
+
+  statistics stats() {
+    std::lock_guard lock{m_mutex};
+    return m_stats;
+  }
+};
+
+inline std::ostream &operator<<(std::ostream &os, const buffer_pool::statistics &stats) {
+  return os << "requests: " << stats.requests << ", hit rate: " << stats.hit_rate() * 100
+            << "%, device allocations: " << stats.device_allocations << " (" << stats.device_bytes
+            << " bytes), peak usage: " << stats.peak_in_use << " bytes";
+}
+
+} // namespace clutils
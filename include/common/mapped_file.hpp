@@ -0,0 +1,96 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace clutils {
+
+// Read-only view of a whole file. On POSIX systems the file is mapped, so pages are loaded on first touch and shared
+// between processes; elsewhere it is read into memory.
+class mapped_file {
+  const char *m_data = nullptr;
+  std::size_t m_size = 0;
+  std::vector<char> m_contents;
+
+public:
+  explicit mapped_file(const std::string &path) {
+#ifdef __unix__
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error{"Can't open file " + path};
+
+    struct stat info {};
+    if (::fstat(fd, &info) != 0) {
+      ::close(fd);
+      throw std::runtime_error{"Can't stat file " + path};
+    }
+
+    m_size = static_cast<std::size_t>(info.st_size);
+    if (m_size != 0) {
+      void *ptr = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (ptr == MAP_FAILED) {
+        ::close(fd);
+        throw std::runtime_error{"Can't map file " + path};
+      }
+      m_data = static_cast<const char *>(ptr);
+    }
+
+    ::close(fd);
+#else
+    std::ifstream is{path, std::ios::binary | std::ios::ate};
+    if (!is) throw std::runtime_error{"Can't open file " + path};
+
+    m_contents.resize(static_cast<std::size_t>(is.tellg()));
+    is.seekg(0);
+    if (!is.read(m_contents.data(), m_contents.size())) throw std::runtime_error{"Can't read file " + path};
+
+    m_data = m_contents.data();
+    m_size = m_contents.size();
+#endif
+  }
+
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+
+  mapped_file(mapped_file &&rhs) noexcept
+      : m_data{std::exchange(rhs.m_data, nullptr)}, m_size{std::exchange(rhs.m_size, 0)},
+        m_contents{std::move(rhs.m_contents)} {}
+
+  mapped_file &operator=(mapped_file &&rhs) noexcept {
+    std::swap(m_data, rhs.m_data);
+    std::swap(m_size, rhs.m_size);
+    std::swap(m_contents, rhs.m_contents);
+    return *this;
+  }
+
+  ~mapped_file() {
+#ifdef __unix__
+    if (m_data) ::munmap(const_cast<char *>(m_data), m_size);
+#endif
+  }
+
+  std::string_view data() const { return {m_data, m_size}; }
+};
+
+} // namespace clutils
@@ -0,0 +1,43 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "opencl_include.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace clutils {
+
+inline bool supports_affinity_partition(const cl::Device &device, cl_device_affinity_domain domain) {
+  const auto properties = device.getInfo<CL_DEVICE_PARTITION_PROPERTIES>();
+  if (std::find(properties.begin(), properties.end(), CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN) == properties.end()) {
+    return false;
+  }
+
+  return device.getInfo<CL_DEVICE_PARTITION_AFFINITY_DOMAIN>() & domain;
+}
+
+// Splits the device into one sub-device per affinity domain, e.g. one per NUMA node. A device that can't be
+// partitioned this way comes back as the only element, so callers don't need a separate code path.
+inline std::vector<cl::Device>
+partition_by_affinity_domain(cl::Device device, cl_device_affinity_domain domain = CL_DEVICE_AFFINITY_DOMAIN_NUMA) {
+  if (!supports_affinity_partition(device, domain)) return {device};
+
+  const cl_device_partition_property properties[] = {
+      CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, static_cast<cl_device_partition_property>(domain), 0};
+
+  std::vector<cl::Device> sub_devices;
+  device.createSubDevices(properties, &sub_devices);
+  return sub_devices;
+}
+
+} // namespace clutils
@@ -0,0 +1,100 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "opencl_include.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+namespace clutils {
+
+// Host memory that the device reaches without an intermediate staging copy
+class host_memory_resource {
+public:
+  virtual void *allocate(std::size_t bytes) = 0;
+  virtual void deallocate(void *ptr) = 0;
+  // Whether kernels can take [ptr, ptr + size) directly as an argument instead of a buffer
+  virtual bool shares(const void *, std::size_t) const { return false; }
+  virtual ~host_memory_resource() = default;
+};
+
+// Page-locked host memory. Every allocation is a CL_MEM_ALLOC_HOST_PTR buffer that stays mapped for its whole
+// lifetime, so the driver can DMA straight from it instead of bouncing through an internal staging copy.
+class pinned_memory_resource : public host_memory_resource {
+  cl::Context m_context;
+  cl::CommandQueue m_queue;
+  std::unordered_map<void *, cl::Buffer> m_mapped;
+  std::mutex m_mutex;
+
+public:
+  pinned_memory_resource(cl::Context context, cl::CommandQueue queue)
+      : m_context{std::move(context)}, m_queue{std::move(queue)} {}
+
+  void *allocate(std::size_t bytes) override {
+    cl::Buffer buffer{m_context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, std::max<std::size_t>(bytes, 1)};
+    auto *ptr = m_queue.enqueueMapBuffer(buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, bytes);
+    if (!ptr) throw std::bad_alloc{};
+
+    std::lock_guard lock{m_mutex};
+    m_mapped.emplace(ptr, std::move(buffer));
+    return ptr;
+  }
+
+  void deallocate(void *ptr) override {
+    std::unique_lock lock{m_mutex};
+    auto found = m_mapped.find(ptr);
+    if (found == m_mapped.end()) return;
+
+    auto buffer = std::move(found->second);
+    m_mapped.erase(found);
+    lock.unlock();
+
+    cl::Event unmapped;
+    m_queue.enqueueUnmapMemObject(buffer, ptr, nullptr, &unmapped);
+    unmapped.wait();
+  }
+};
+
+// std::allocator compatible front-end for a host_memory_resource, e.g. std::vector<char, pinned_allocator<char>>.
+// Elements are default-initialized, so resizing a buffer before reading into it does not touch the memory twice.
+template <typename T> class pinned_allocator {
+  std::shared_ptr<host_memory_resource> m_resource;
+
+  template <typename U> friend class pinned_allocator;
+
+public:
+  using value_type = T;
+
+  explicit pinned_allocator(std::shared_ptr<host_memory_resource> resource) : m_resource{std::move(resource)} {}
+  template <typename U> pinned_allocator(const pinned_allocator<U> &rhs) : m_resource{rhs.m_resource} {}
+
+  T *allocate(std::size_t n) { return static_cast<T *>(m_resource->allocate(n * sizeof(T))); }
+  void deallocate(T *ptr, std::size_t) { m_resource->deallocate(ptr); }
+
+  template <typename U> void construct(U *ptr) noexcept(std::is_nothrow_default_constructible_v<U>) {
+    ::new (static_cast<void *>(ptr)) U;
+  }
+
+  template <typename U, typename... Ts> void construct(U *ptr, Ts &&...args) {
+    ::new (static_cast<void *>(ptr)) U(std::forward<Ts>(args)...);
+  }
+
+  template <typename U> bool operator==(const pinned_allocator<U> &rhs) const { return m_resource == rhs.m_resource; }
+};
+
+} // namespace clutils
@@ -21,6 +21,7 @@
 #include <stdexcept>
 #include <string>
 #include <system_error>
+#include <utility>
 
 namespace clutils {
 
@@ -104,7 +105,7 @@ public:
 
   platform_selector(
       platform_version min_ver, bool verbose = true, platform_pred_type platform_pred = default_pred,
-      device_pred_type device_pred = default_pred
+      device_pred_type device_pred = default_pred, cl_device_type device_type = CL_DEVICE_TYPE_GPU
   ) {
     std::vector<cl::Platform> platforms, suitable_platforms;
     cl::Platform::get(&platforms);
@@ -131,7 +132,7 @@ public:
 
     auto chosen_platform = std::find_if(suitable_platforms.begin(), suitable_platforms.end(), [&](auto p) {
       std::vector<cl::Device> devices;
-      p.getDevices(CL_DEVICE_TYPE_GPU, &devices);
+      p.getDevices(device_type, &devices);
 
       auto chosen_device =
           std::find_if(devices.begin(), devices.end(), [device_pred](auto d) { return device_pred(d); });
@@ -148,6 +149,10 @@ public:
     if (chosen_platform == suitable_platforms.end()) throw std::runtime_error{"No suitable OpenCL device found"};
     m_platform = *chosen_platform;
   }
+
+  // For devices that were not found by the selector, e.g. sub-devices of an already selected one
+  platform_selector(cl::Platform platform, cl::Device device)
+      : m_platform{std::move(platform)}, m_device{std::move(device)} {}
 };
 
 }; // namespace clutils
\ No newline at end of file
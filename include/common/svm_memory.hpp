@@ -0,0 +1,114 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "opencl_include.hpp"
+#include "pinned_allocator.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+
+namespace clutils {
+
+// Fine-grained shared virtual memory. Host and device see the same allocation coherently at synchronization points,
+// so the pointer itself is passed to kernels and nothing is ever copied, mapped or unmapped. With system SVM every
+// host pointer qualifies, otherwise only the allocations made here do.
+class svm_memory_resource : public host_memory_resource {
+  cl::Context m_context;
+  bool m_system;
+  std::map<const char *, std::size_t> m_allocations;
+  mutable std::mutex m_mutex;
+
+public:
+  svm_memory_resource(cl::Context context, bool system) : m_context{std::move(context)}, m_system{system} {}
+
+  void *allocate(std::size_t bytes) override {
+    auto *ptr = clSVMAlloc(
+        m_context(), CL_MEM_READ_WRITE | CL_MEM_SVM_FINE_GRAIN_BUFFER, std::max<std::size_t>(bytes, 1), 0
+    );
+    if (!ptr) throw std::bad_alloc{};
+
+    std::lock_guard lock{m_mutex};
+    m_allocations.emplace(static_cast<const char *>(ptr), bytes);
+    return ptr;
+  }
+
+  void deallocate(void *ptr) override {
+    std::unique_lock lock{m_mutex};
+    if (!m_allocations.erase(static_cast<const char *>(ptr))) return;
+    lock.unlock();
+
+    clSVMFree(m_context(), ptr);
+  }
+
+  bool shares(const void *ptr, std::size_t size) const override {
+    if (m_system) return true;
+
+    const auto *first = static_cast<const char *>(ptr);
+    std::lock_guard lock{m_mutex};
+    auto found = m_allocations.upper_bound(first);
+    if (found == m_allocations.begin()) return false;
+
+    --found;
+    return first + size <= found->first + found->second;
+  }
+};
+
+// Owning fixed-size SVM array, value-initialized. With CL_MEM_SVM_ATOMICS in `flags` host and device may update it
+// concurrently through atomics while a kernel is running.
+template <typename T> class svm_array {
+  cl::Context m_context;
+  T *m_data = nullptr;
+  std::size_t m_size = 0;
+
+public:
+  svm_array() = default;
+
+  svm_array(cl::Context context, std::size_t size, cl_svm_mem_flags flags = CL_MEM_SVM_FINE_GRAIN_BUFFER)
+      : m_context{std::move(context)}, m_size{size} {
+    void *ptr = clSVMAlloc(m_context(), CL_MEM_READ_WRITE | flags, std::max<std::size_t>(size * sizeof(T), 1), 0);
+    if (!ptr) throw std::bad_alloc{};
+
+    m_data = static_cast<T *>(ptr);
+    std::uninitialized_value_construct_n(m_data, m_size);
+  }
+
+  svm_array(const svm_array &) = delete;
+  svm_array &operator=(const svm_array &) = delete;
+
+  svm_array(svm_array &&rhs) noexcept
+      : m_context{std::move(rhs.m_context)}, m_data{std::exchange(rhs.m_data, nullptr)},
+        m_size{std::exchange(rhs.m_size, 0)} {}
+
+  svm_array &operator=(svm_array &&rhs) noexcept {
+    std::swap(m_context, rhs.m_context);
+    std::swap(m_data, rhs.m_data);
+    std::swap(m_size, rhs.m_size);
+    return *this;
+  }
+
+  ~svm_array() {
+    if (m_data) clSVMFree(m_context(), m_data);
+  }
+
+  T *data() const { return m_data; }
+  std::size_t size() const { return m_size; }
+  T &operator[](std::size_t i) const { return m_data[i]; }
+  T *begin() const { return m_data; }
+  T *end() const { return m_data + m_size; }
+};
+
+} // namespace clutils
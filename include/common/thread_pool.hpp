@@ -0,0 +1,235 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace clutils {
+
+// Work-stealing pool. Every worker owns a deque: it pushes and pops its own tasks at the back, idle workers steal
+// from the front of the others. Tasks submitted from inside a worker stay on that worker, so nested parallel_for
+// calls keep their data hot, and a thread waiting for tasks runs queued work instead of blocking.
+class thread_pool {
+  using task_type = std::function<void()>;
+
+  struct worker_queue {
+    std::deque<task_type> tasks;
+    std::mutex mutex;
+  };
+
+  std::vector<std::unique_ptr<worker_queue>> m_queues;
+  std::vector<std::thread> m_threads;
+
+  std::mutex m_sleep_mutex;
+  std::condition_variable m_wake;
+  std::atomic<std::size_t> m_pending = 0, m_next_queue = 0;
+  bool m_stop = false;
+
+  static inline thread_local const thread_pool *t_owner = nullptr;
+  static inline thread_local std::size_t t_index = 0;
+
+  // CPUs the process may run on, so that pinning respects taskset and cgroup limits
+  static std::vector<int> allowed_cpus() {
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+      for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+      }
+    }
+#endif
+    return cpus;
+  }
+
+  static void pin_to_cpu([[maybe_unused]] std::thread &thread, [[maybe_unused]] int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+  }
+
+  bool pop_local(std::size_t index, task_type &task) {
+    auto &queue = *m_queues[index];
+    std::lock_guard lock{queue.mutex};
+    if (queue.tasks.empty()) return false;
+
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+  }
+
+  bool steal(std::size_t thief, task_type &task) {
+    for (std::size_t i = 1; i <= m_queues.size(); ++i) {
+      auto &queue = *m_queues[(thief + i) % m_queues.size()];
+      std::lock_guard lock{queue.mutex};
+      if (queue.tasks.empty()) continue;
+
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      return true;
+    }
+
+    return false;
+  }
+
+  bool try_run_one(std::size_t index) {
+    task_type task;
+    if (!pop_local(index, task) && !steal(index, task)) return false;
+
+    --m_pending;
+    task();
+    return true;
+  }
+
+  void worker_loop(std::size_t index) {
+    t_owner = this;
+    t_index = index;
+
+    for (;;) {
+      if (try_run_one(index)) continue;
+
+      std::unique_lock lock{m_sleep_mutex};
+      m_wake.wait(lock, [this] { return m_stop || m_pending > 0; });
+      if (m_stop && m_pending == 0) return;
+    }
+  }
+
+  void push(task_type task) {
+    // Counted before it becomes visible, so that a thief never takes the counter below zero
+    {
+      std::lock_guard lock{m_sleep_mutex};
+      ++m_pending;
+    }
+
+    const auto index = (t_owner == this ? t_index : m_next_queue++ % m_queues.size());
+    {
+      auto &queue = *m_queues[index];
+      std::lock_guard lock{queue.mutex};
+      queue.tasks.push_back(std::move(task));
+    }
+
+    m_wake.notify_one();
+  }
+
+public:
+  // With `pin` set worker i is bound to the i-th CPU the process may use, which keeps per-thread data in one cache
+  // and NUMA node. By default there is one worker per CPU: per CPU the process may use when pinned, per hardware
+  // thread otherwise.
+  explicit thread_pool(std::size_t num_threads = 0, bool pin = false) {
+    const auto cpus = (pin ? allowed_cpus() : std::vector<int>{});
+    if (num_threads == 0) num_threads = (cpus.empty() ? std::thread::hardware_concurrency() : cpus.size());
+    num_threads = std::max<std::size_t>(num_threads, 1);
+    for (std::size_t i = 0; i < num_threads; ++i) {
+      m_queues.push_back(std::make_unique<worker_queue>());
+    }
+
+    for (std::size_t i = 0; i < num_threads; ++i) {
+      m_threads.emplace_back([this, i] { worker_loop(i); });
+      if (!cpus.empty()) pin_to_cpu(m_threads.back(), cpus[i % cpus.size()]);
+    }
+  }
+
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  ~thread_pool() {
+    {
+      std::lock_guard lock{m_sleep_mutex};
+      m_stop = true;
+    }
+    m_wake.notify_all();
+
+    for (auto &thread : m_threads) {
+      thread.join();
+    }
+  }
+
+  std::size_t size() const { return m_threads.size(); }
+
+  template <typename F> auto submit(F func) -> std::future<std::invoke_result_t<F>> {
+    auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::move(func));
+    auto future = task->get_future();
+    push([task] { (*task)(); });
+    return future;
+  }
+
+  // Runs queued tasks on the calling thread until the future is ready, so waiting inside a worker can't deadlock
+  template <typename T> T wait(std::future<T> &future) {
+    const auto index = (t_owner == this ? t_index : 0);
+    while (future.wait_for(std::chrono::seconds{0}) != std::future_status::ready) {
+      if (!try_run_one(index)) std::this_thread::yield();
+    }
+    return future.get();
+  }
+
+  // Calls func(first, last) on consecutive ranges of at most `grain` indices out of [begin, end)
+  template <typename F> void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, F func) {
+    grain = std::max<std::size_t>(grain, 1);
+
+    std::vector<std::future<void>> parts;
+    for (auto first = begin; first < end; first += grain) {
+      const auto last = std::min(end, first + grain);
+      parts.push_back(submit([&func, first, last] { func(first, last); }));
+    }
+
+    // Every part refers to func, so all of them have to finish before an exception leaves this frame
+    std::exception_ptr error;
+    for (auto &part : parts) {
+      try {
+        wait(part);
+      } catch (...) {
+        if (!error) error = std::current_exception();
+      }
+    }
+
+    if (error) std::rethrow_exception(error);
+  }
+};
+
+namespace detail {
+inline bool pin_default_pool = false;
+} // namespace detail
+
+// Pins the workers of the default pool to CPUs. Takes effect only when called before the pool is first used.
+inline void pin_default_thread_pool(bool pin = true) {
+  detail::pin_default_pool = pin;
+}
+
+// Shared by all host stages of a process
+inline thread_pool &default_thread_pool() {
+  static thread_pool pool{0, detail::pin_default_pool};
+  return pool;
+}
+
+} // namespace clutils
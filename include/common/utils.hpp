@@ -12,6 +12,9 @@
 
 #include "opencl_include.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <iostream>
 #include <random>
 #include <sstream>
@@ -49,8 +52,12 @@ template <class T> inline std::size_t sizeof_container(const T &container) {
   return sizeof(typename T::value_type) * container.size();
 }
 
+// Fractional milliseconds, kernels of small workloads often take less than one. `pure` is NaN when the kernel can't be
+// timed on its own, as for a persistent kernel that serves many calls.
 struct profiling_info {
-  std::chrono::milliseconds pure, wall;
+  std::chrono::duration<double, std::milli> pure, wall;
+
+  bool has_pure() const { return !std::isnan(pure.count()); }
 };
 
 } // namespace clutils
\ No newline at end of file
@@ -0,0 +1,361 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "alphabet.hpp"
+
+#include "common/thread_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace matching {
+
+struct build_phase {
+  std::string name;
+  std::chrono::milliseconds time;
+  std::size_t peak_bytes; // Held by the builder during the phase, tables and temporaries
+};
+
+// Filled by the automaton constructor when requested
+struct build_report {
+  std::vector<build_phase> phases;
+};
+
+inline std::ostream &operator<<(std::ostream &os, const build_report &report) {
+  for (const auto &phase : report.phases) {
+    os << phase.name << ": " << phase.time.count() << " ms, " << phase.peak_bytes / 1048576.0 << " MiB\n";
+  }
+  return os;
+}
+
+// Aho-Corasick automaton with a fully materialized transition function, flattened into a row-major table of
+// num_states() x num_classes() entries so that it can be copied to the device as is.
+class automaton {
+public:
+  using state_type = std::uint32_t;
+  static constexpr state_type root = 0;
+  static constexpr state_type no_needle = std::numeric_limits<state_type>::max();
+
+private:
+  byte_classes m_classes;
+  std::vector<state_type> m_transitions;
+  std::vector<state_type> m_needle_of; // Canonical needle ending in this state or no_needle
+  std::vector<state_type> m_dict_link; // Closest terminal state on the failure chain, root if there is none
+  std::vector<state_type> m_depth;
+  std::vector<state_type> m_canonical; // Duplicate needles are counted once and copied over afterwards
+  std::size_t m_max_needle_length = 0;
+
+  // Trie node of a subtrie under construction. Subtries store only the tree edges, one node record each, in a
+  // single growing array, and are spread into the dense table once their sizes are known.
+  struct trie_node {
+    state_type parent; // Local index within the subtrie, unused for its first node
+    state_type depth;
+    state_type symbol;
+    state_type needle = no_needle;
+  };
+
+  state_type &transition(state_type state, unsigned symbol) { return m_transitions[state * num_classes() + symbol]; }
+
+  // Needles of one group are sorted, so every needle shares its longest common prefix with the previous one and only
+  // the rest of it creates nodes
+  std::vector<trie_node> build_subtrie(
+      const std::vector<state_type> &group, const std::vector<std::string> &translated, std::size_t num_nodes_hint
+  ) {
+    std::vector<trie_node> nodes;
+    nodes.reserve(num_nodes_hint);
+    std::vector<state_type> path; // path[d] is the node at depth d + 1 along the previous needle
+    std::string_view previous;
+
+    for (auto index : group) {
+      const std::string_view needle = translated[index];
+      const auto lcp = static_cast<std::size_t>(
+          std::mismatch(needle.begin(), needle.end(), previous.begin(), previous.end()).first - needle.begin()
+      );
+      path.resize(lcp);
+
+      for (auto d = lcp; d < needle.size(); ++d) {
+        const auto parent = (d ? path[d - 1] : root);
+        path.push_back(static_cast<state_type>(nodes.size()));
+        nodes.push_back({parent, static_cast<state_type>(d + 1), static_cast<unsigned char>(needle[d])});
+      }
+
+      auto &end = nodes[path.back()];
+      if (end.needle == no_needle) end.needle = index;
+      m_canonical[index] = end.needle;
+      previous = needle;
+    }
+
+    return nodes;
+  }
+
+  template <typename It>
+  void build(It needles_start, It needles_finish, clutils::thread_pool &pool, build_report *report) {
+    using clock = std::chrono::steady_clock;
+    auto phase_start = clock::now();
+    std::size_t peak_bytes = 0;
+
+    const auto end_phase = [&](const char *name) {
+      const auto now = clock::now();
+      if (report) {
+        report->phases.push_back(
+            {name, std::chrono::duration_cast<std::chrono::milliseconds>(now - phase_start), peak_bytes}
+        );
+      }
+      phase_start = now;
+      peak_bytes = 0;
+    };
+
+    // Partition: needles are translated into class strings, grouped by their first class and sorted within groups
+    const std::vector<std::string_view> needles(needles_start, needles_finish);
+    std::vector<std::string> translated(needles.size());
+    m_canonical.resize(needles.size());
+
+    constexpr std::size_t needle_grain = 1 << 12;
+    pool.parallel_for(0, needles.size(), needle_grain, [&](std::size_t first, std::size_t last) {
+      for (auto i = first; i < last; ++i) {
+        if (needles[i].empty()) throw std::invalid_argument{"Empty needles are not allowed"};
+
+        translated[i].resize(needles[i].size());
+        std::transform(needles[i].begin(), needles[i].end(), translated[i].begin(), [&](char byte) {
+          return static_cast<char>(m_classes(byte));
+        });
+      }
+    });
+
+    std::vector<std::vector<state_type>> groups(num_classes());
+    std::vector<std::size_t> group_length(num_classes(), 0);
+    for (state_type i = 0; i < translated.size(); ++i) {
+      const auto first = static_cast<unsigned char>(translated[i][0]);
+      groups[first].push_back(i);
+      group_length[first] += translated[i].size();
+      m_max_needle_length = std::max(m_max_needle_length, translated[i].size());
+    }
+
+    pool.parallel_for(0, groups.size(), 1, [&](std::size_t first, std::size_t last) {
+      for (auto g = first; g < last; ++g) {
+        std::stable_sort(groups[g].begin(), groups[g].end(), [&](auto lhs, auto rhs) {
+          return translated[lhs] < translated[rhs];
+        });
+      }
+    });
+
+    for (const auto &t : translated) {
+      peak_bytes += t.capacity() + sizeof(t);
+    }
+    const auto partition_bytes = peak_bytes + 2 * sizeof(state_type) * translated.size(); // Groups and m_canonical
+    peak_bytes = partition_bytes;
+    end_phase("partition");
+
+    // Subtries, one per first class, built concurrently
+    std::vector<std::vector<trie_node>> subtries(num_classes());
+    pool.parallel_for(0, groups.size(), 1, [&](std::size_t first, std::size_t last) {
+      for (auto g = first; g < last; ++g) {
+        if (!groups[g].empty()) subtries[g] = build_subtrie(groups[g], translated, group_length[g]);
+      }
+    });
+
+    std::size_t subtrie_bytes = 0;
+    for (const auto &subtrie : subtries) {
+      subtrie_bytes += subtrie.capacity() * sizeof(trie_node);
+    }
+    peak_bytes = partition_bytes + subtrie_bytes;
+    end_phase("subtries");
+
+    translated = {};
+    groups = {};
+
+    // Merge: subtries get consecutive state ranges after the root and their edges are written into the dense table
+    std::vector<state_type> offsets(num_classes(), 0);
+    state_type states = 1;
+    for (unsigned g = 0; g < num_classes(); ++g) {
+      offsets[g] = states;
+      states += static_cast<state_type>(subtries[g].size());
+    }
+
+    m_transitions.assign(std::size_t{states} * num_classes(), root);
+    m_needle_of.assign(states, no_needle);
+    m_depth.assign(states, 0);
+
+    for (unsigned g = 0; g < num_classes(); ++g) {
+      if (!subtries[g].empty()) transition(root, g) = offsets[g];
+    }
+
+    pool.parallel_for(0, subtries.size(), 1, [&](std::size_t first, std::size_t last) {
+      for (auto g = first; g < last; ++g) {
+        const auto &nodes = subtries[g];
+        for (state_type local = 0; local < nodes.size(); ++local) {
+          const auto state = offsets[g] + local;
+          m_depth[state] = nodes[local].depth;
+          m_needle_of[state] = nodes[local].needle;
+          if (local) transition(offsets[g] + nodes[local].parent, nodes[local].symbol) = state;
+        }
+      }
+    });
+
+    peak_bytes = subtrie_bytes + sizeof(state_type) * (m_canonical.size() + m_transitions.size() + m_needle_of.size() +
+                                                       m_depth.size());
+    end_phase("merge");
+
+    subtries = {};
+    build_failure_links(pool, peak_bytes);
+    end_phase("failure links");
+  }
+
+  // Level-synchronous breadth-first traversal that turns the trie into a complete DFA. All states of one depth are
+  // processed in parallel: a state only writes its own row and the failure links of its children, and reads rows of
+  // its failure state, which is shallower and therefore final.
+  void build_failure_links(clutils::thread_pool &pool, std::size_t &peak_bytes) {
+    std::vector<state_type> failure(num_states(), root), frontier;
+    m_dict_link.assign(num_states(), root);
+
+    for (unsigned c = 0; c < num_classes(); ++c) {
+      if (auto child = transition(root, c); child != root) frontier.push_back(child);
+    }
+
+    const auto table_bytes = sizeof(state_type) * (m_canonical.size() + m_transitions.size() + m_needle_of.size() +
+                                                   m_depth.size() + m_dict_link.size() + failure.size());
+
+    constexpr std::size_t state_grain = 1 << 10;
+    while (!frontier.empty()) {
+      std::vector<std::vector<state_type>> next_parts((frontier.size() + state_grain - 1) / state_grain);
+
+      pool.parallel_for(0, frontier.size(), state_grain, [&](std::size_t first, std::size_t last) {
+        auto &next_level = next_parts[first / state_grain];
+        for (auto i = first; i < last; ++i) {
+          const auto state = frontier[i];
+          const auto fail = failure[state];
+          m_dict_link[state] = (m_needle_of[fail] != no_needle ? fail : m_dict_link[fail]);
+
+          for (unsigned c = 0; c < num_classes(); ++c) {
+            auto &next = transition(state, c);
+            if (next != root && m_depth[next] == m_depth[state] + 1) {
+              failure[next] = transition(fail, c);
+              next_level.push_back(next);
+            } else {
+              next = transition(fail, c);
+            }
+          }
+        }
+      });
+
+      auto frontier_bytes = sizeof(state_type) * frontier.size();
+      frontier.clear();
+      for (const auto &part : next_parts) {
+        frontier.insert(frontier.end(), part.begin(), part.end());
+        frontier_bytes += sizeof(state_type) * part.size();
+      }
+      peak_bytes = std::max(peak_bytes, table_bytes + frontier_bytes);
+    }
+  }
+
+public:
+  automaton() = default;
+
+  template <typename It>
+  automaton(
+      It needles_start, It needles_finish, const byte_classes &classes = byte_classes::identity(),
+      build_report *report = nullptr, clutils::thread_pool &pool = clutils::default_thread_pool()
+  )
+      : m_classes{classes.compact(needles_start, needles_finish)} {
+    build(needles_start, needles_finish, pool, report);
+  }
+
+  // Automaton over ready-made tables, such as a minimized pattern DFA. Every needle is its own canonical needle, and
+  // there is no trie, so such an automaton can't drive PFAC.
+  static automaton from_tables(
+      const byte_classes &classes, std::vector<state_type> transitions, std::vector<state_type> needle_of,
+      std::vector<state_type> dict_link, std::size_t num_needles, std::size_t max_needle_length
+  ) {
+    automaton dfa;
+    dfa.m_classes = classes;
+    dfa.m_transitions = std::move(transitions);
+    dfa.m_needle_of = std::move(needle_of);
+    dfa.m_dict_link = std::move(dict_link);
+    dfa.m_canonical.resize(num_needles);
+    std::iota(dfa.m_canonical.begin(), dfa.m_canonical.end(), state_type{0});
+    dfa.m_max_needle_length = max_needle_length;
+    return dfa;
+  }
+
+  // Reference host implementation. Returns the number of (possibly overlapping) occurrences of every needle.
+  std::vector<unsigned> count(std::string_view haystack) const {
+    std::vector<unsigned> counts(num_needles(), 0);
+
+    state_type state = root;
+    for (auto byte : haystack) {
+      state = next(state, byte);
+      for (auto o = first_output(state); o != root; o = m_dict_link[o]) {
+        ++counts[m_needle_of[o]];
+      }
+    }
+
+    return expand_counts(counts);
+  }
+
+  state_type next(state_type state, char byte) const { return m_transitions[state * num_classes() + m_classes(byte)]; }
+  state_type first_output(state_type state) const {
+    return (m_needle_of[state] != no_needle ? state : m_dict_link[state]);
+  }
+
+  // Goto function of the underlying trie without failure transitions. Missing edges lead to the root, which can't
+  // be reentered otherwise, so it doubles as a dead state.
+  std::vector<state_type> trie_transitions() const {
+    if (!has_trie()) throw std::invalid_argument{"Automaton has no underlying trie"};
+    std::vector<state_type> trie(m_transitions.size(), root);
+
+    for (state_type state = 0; state < num_states(); ++state) {
+      for (unsigned c = 0; c < num_classes(); ++c) {
+        const auto next = m_transitions[state * num_classes() + c];
+        if (m_depth[next] == m_depth[state] + 1) trie[state * num_classes() + c] = next;
+      }
+    }
+
+    return trie;
+  }
+
+  // Copy counts of canonical needles into their duplicates
+  template <typename T> std::vector<T> expand_counts(const std::vector<T> &canonical_counts) const {
+    std::vector<T> counts(num_needles());
+    std::transform(m_canonical.begin(), m_canonical.end(), counts.begin(), [&](auto c) {
+      return canonical_counts[c];
+    });
+    return counts;
+  }
+
+  const byte_classes &classes() const { return m_classes; }
+  const std::vector<state_type> &transitions() const { return m_transitions; }
+  const std::vector<state_type> &needle_of() const { return m_needle_of; }
+  const std::vector<state_type> &dict_link() const { return m_dict_link; }
+  const std::vector<state_type> &depth() const { return m_depth; }
+  bool has_trie() const { return !m_depth.empty(); }
+
+  state_type num_states() const { return static_cast<state_type>(m_needle_of.size()); }
+  unsigned num_classes() const { return m_classes.size(); }
+  std::size_t num_needles() const { return m_canonical.size(); }
+  std::size_t max_needle_length() const { return m_max_needle_length; }
+
+  // Size of the tables that a device engine has to upload, in bytes
+  std::size_t footprint() const {
+    return sizeof(state_type) * (m_transitions.size() + m_needle_of.size() + m_dict_link.size()) +
+           byte_classes::max_classes;
+  }
+};
+
+} // namespace matching
@@ -0,0 +1,166 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "aho_corasick.hpp"
+#include "counting.hpp"
+#include "device.hpp"
+#include "engine.hpp"
+#include "packing.hpp"
+
+#include "kernelhpp/aho_corasick_kernel.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace matching {
+
+// Chunked Aho-Corasick scan. Each work-item walks the flattened DFA over its own chunk of the haystack. With sub-group
+// support hits are aggregated across the sub-group before they are counted, and unless global counting is asked for
+// every work-group counts into a table in local memory that is merged into the global counters at its end.
+//
+// Haystacks that have to be uploaded and hold at most 16 automaton classes (judging by their first 64 KiB) are packed
+// into 2 or 4 bits per symbol on the host, and a kernel variant scans the packed words directly, so a quarter or a
+// half of the bytes cross the bus and are read by the device. A haystack with a class the sample missed is scanned as
+// bytes.
+class aho_corasick_engine : public engine {
+  static constexpr std::size_t max_group_size = 256;
+  static constexpr std::size_t packing_sample = 1 << 16;
+
+  struct packed_variant {
+    cl::Program program;
+    cl::Kernel kernel;
+    std::size_t group_size;
+  };
+
+  const device_context &m_ctx;
+  automaton m_automaton;
+  unsigned m_chunk_size;
+  counting_plan m_counting;
+
+  cl::Program m_program;
+  cl::Kernel m_kernel;
+  device_array m_classes, m_transitions, m_needle_of, m_dict_link;
+  std::size_t m_group_size;
+
+  bool m_packing;
+  std::array<std::optional<packed_variant>, 2> m_packed_variants; // 2 and 4 bits, built on first use
+  pinned_buffer m_packed;
+
+  std::string source(unsigned pack_bits) const {
+    return aho_corasick_kernel::source(
+        m_automaton.num_classes(), static_cast<unsigned>(m_automaton.max_needle_length() - 1), m_ctx.has_subgroups(),
+        static_cast<unsigned>(m_counting.strategy), m_counting.table_size, pack_bits
+    );
+  }
+
+  std::size_t group_size(const cl::Kernel &kernel) const {
+    return std::min<std::size_t>(max_group_size, kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(m_ctx.device()));
+  }
+
+  packed_variant &packed(unsigned bits) {
+    auto &variant = m_packed_variants[bits / 4];
+    if (!variant) {
+      cl::Program program = m_ctx.build_program(source(bits), false, m_ctx.has_subgroups());
+      cl::Kernel kernel{program, aho_corasick_kernel::entry().c_str()};
+      const auto size = group_size(kernel);
+      variant.emplace(packed_variant{std::move(program), std::move(kernel), size});
+    }
+    return *variant;
+  }
+
+  // Scans `num_symbols` symbols of `data`, which are bytes or packed codes depending on the kernel
+  match_result scan(
+      cl::Kernel &kernel, std::size_t group_size, std::string_view data, std::size_t num_symbols,
+      const device_array &classes, std::chrono::high_resolution_clock::time_point wall_start
+  ) {
+    const auto num_chunks = (num_symbols + m_chunk_size - 1) / m_chunk_size;
+
+    // Local tables are merged once per work-group, so groups are made as large as possible. The kernel keeps the
+    // work-items past the last chunk idle.
+    const bool local_tables = (m_counting.strategy != counting::global);
+    const auto num_groups = (num_chunks + group_size - 1) / group_size;
+    const auto global_size = (local_tables ? num_groups * group_size : num_chunks);
+    const auto local_size = (local_tables ? cl::NDRange{group_size} : cl::NullRange);
+    const auto haystack_size = haystack_length(num_symbols, global_size, m_chunk_size);
+
+    const auto [device, event] = count_matches(
+        m_ctx, data, m_automaton.num_needles(),
+        [&](const auto &deps, const auto &haystack_arg, const auto &counts_arg) {
+          set_kernel_args(
+              kernel, haystack_arg, haystack_size, m_chunk_size, classes, m_transitions, m_needle_of, m_dict_link,
+              counts_arg
+          );
+
+          cl::Event done;
+          m_ctx.queue().enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange{global_size}, local_size, &deps, &done);
+          return done;
+        }
+    );
+
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+    return {
+        m_automaton.expand_counts(device),
+        {to_millis(event_duration(event)), to_millis(wall_end - wall_start)}
+    };
+  }
+
+public:
+  aho_corasick_engine(
+      const device_context &ctx, automaton dfa, unsigned chunk_size = default_chunk_size,
+      counting strategy = counting::automatic, bool packing = true
+  )
+      : m_ctx{ctx}, m_automaton{std::move(dfa)}, m_chunk_size{chunk_size},
+        m_counting{choose_counting(m_automaton.num_needles(), m_ctx.device(), strategy)},
+        m_program{m_ctx.build_program(source(0), false, m_ctx.has_subgroups())},
+        m_kernel{m_program, aho_corasick_kernel::entry().c_str()},
+        m_classes{m_ctx, m_automaton.classes().table()},
+        m_transitions{m_ctx, m_automaton.transitions()},
+        m_needle_of{m_ctx, m_automaton.needle_of()},
+        m_dict_link{m_ctx, m_automaton.dict_link()},
+        m_group_size{group_size(m_kernel)},
+        m_packing{packing && m_ctx.device().getInfo<CL_DEVICE_ENDIAN_LITTLE>()},
+        m_packed{m_ctx.make_pinned_buffer()} {}
+
+  match_result match(std::string_view haystack) override {
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+    if (haystack.empty()) return {m_automaton.expand_counts(std::vector<cl_uint>(m_automaton.num_needles(), 0)), {}};
+
+    // Packing pays off only for haystacks that are copied to the device, not for SVM or resident ones
+    const bool uploaded = (m_ctx.mode() == memory_mode::buffer &&
+                           !(m_ctx.residency() && m_ctx.residency()->find(haystack)));
+    if (m_packing && uploaded) {
+      const auto plan = plan_packing(m_automaton.classes(), haystack.substr(0, packing_sample));
+      if (plan.bits && pack_haystack(plan, haystack, m_packed)) {
+        auto &variant = packed(plan.bits);
+        const device_array classes{m_ctx, plan.class_of};
+        return scan(
+            variant.kernel, variant.group_size, {m_packed.data(), m_packed.size()}, haystack.size(), classes,
+            wall_start
+        );
+      }
+    }
+
+    return scan(m_kernel, m_group_size, haystack, haystack.size(), m_classes, wall_start);
+  }
+
+  std::string name() const override { return "ac"; }
+  std::size_t footprint() const override { return m_automaton.footprint(); }
+  const automaton &get_automaton() const { return m_automaton; }
+  counting_plan get_counting() const { return m_counting; }
+};
+
+} // namespace matching
@@ -0,0 +1,124 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+#include <string_view>
+
+namespace matching {
+
+// Byte to equivalence class translation table. Automatons are built over classes instead of raw bytes, so the
+// transition table has size() columns instead of 256. Kernels apply the same table inline while scanning.
+class byte_classes {
+public:
+  static constexpr unsigned max_classes = 256;
+  using table_type = std::array<std::uint8_t, max_classes>;
+  using element_type = char;
+  using class_type = std::uint8_t;
+
+private:
+  table_type m_table;
+  unsigned m_count = max_classes;
+
+  // Relabel classes densely in order of their first occurrence
+  void normalize() {
+    std::array<int, max_classes> relabel;
+    relabel.fill(-1);
+
+    unsigned next = 0;
+    for (auto &c : m_table) {
+      if (relabel[c] == -1) relabel[c] = next++;
+      c = relabel[c];
+    }
+
+    m_count = next;
+  }
+
+public:
+  byte_classes() { std::iota(m_table.begin(), m_table.end(), 0); }
+
+  static byte_classes identity() { return byte_classes{}; }
+
+  // Classes given by an arbitrary labelling of the bytes, relabelled densely
+  static byte_classes from_table(const table_type &table) {
+    byte_classes classes;
+    classes.m_table = table;
+    classes.normalize();
+    return classes;
+  }
+
+  static byte_classes case_insensitive() {
+    byte_classes classes;
+    for (unsigned c = 'a'; c <= 'z'; ++c) {
+      classes.m_table[c] = classes.m_table[std::toupper(c)];
+    }
+    classes.normalize();
+    return classes;
+  }
+
+  // Put all bytes from the group into a single class. Classes are transitive, so merging "aA" and "Aa" is a no-op.
+  byte_classes &merge(std::string_view group) {
+    if (group.empty()) return *this;
+
+    const auto target = m_table[static_cast<std::uint8_t>(group.front())];
+    for (auto byte : group) {
+      const auto source = m_table[static_cast<std::uint8_t>(byte)];
+      if (source == target) continue;
+      for (auto &c : m_table) {
+        if (c == source) c = target;
+      }
+    }
+
+    normalize();
+    return *this;
+  }
+
+  // Keep only classes that occur in needles. Every other byte falls into class 0, which the automaton treats as a
+  // symbol with no outgoing trie edges.
+  template <typename It> byte_classes compact(It needles_start, It needles_finish) const {
+    std::array<bool, max_classes> used{};
+    for (; needles_start != needles_finish; ++needles_start) {
+      for (auto byte : *needles_start) {
+        used[m_table[static_cast<std::uint8_t>(byte)]] = true;
+      }
+    }
+
+    const auto used_count = static_cast<unsigned>(std::count(used.begin(), used.end(), true));
+    if (used_count == m_count) return *this;
+
+    std::array<std::uint8_t, max_classes> relabel{};
+    for (unsigned c = 0, next = 1; c < m_count; ++c) {
+      if (used[c]) relabel[c] = next++;
+    }
+
+    byte_classes compacted;
+    for (unsigned b = 0; b < max_classes; ++b) {
+      compacted.m_table[b] = relabel[m_table[b]];
+    }
+    compacted.m_count = used_count + 1;
+
+    return compacted;
+  }
+
+  unsigned operator()(char byte) const { return m_table[static_cast<std::uint8_t>(byte)]; }
+  unsigned size() const { return m_count; }
+  const table_type &table() const { return m_table; }
+  std::size_t table_size() const { return max_classes; }
+  std::size_t footprint() const { return max_classes; }
+};
+
+} // namespace matching
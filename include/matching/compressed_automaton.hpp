@@ -0,0 +1,234 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "alphabet.hpp"
+#include "symbols.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace matching {
+
+// Aho-Corasick automaton for dictionaries whose full transition table does not fit into memory. States are numbered
+// in breadth-first order. The shallow ones (depth < dense_depth), which are visited most of the time, keep complete
+// DFA rows. Every other state only stores its trie edges as a sorted sparse list and defers missing symbols to its
+// failure state, so the table takes O(number of trie edges) memory.
+//
+// The automaton is generic over the classes of its haystack elements: bytes with byte_classes, or 16 and 32-bit
+// symbols with symbol_classes, whose needles are vectors of symbols. Haystacks are always passed as raw bytes. Large
+// alphabets would make dense rows huge, so dense states are also capped at max_dense_entries table entries.
+template <typename Classes> class basic_compressed_automaton {
+public:
+  using state_type = std::uint32_t;
+  using element_type = typename Classes::element_type;
+  using symbol_type = typename Classes::class_type;
+  static constexpr state_type root = 0;
+  static constexpr state_type no_needle = std::numeric_limits<state_type>::max();
+  static constexpr unsigned default_dense_depth = 2;
+  static constexpr std::size_t max_dense_entries = 1 << 22;
+
+private:
+  Classes m_classes;
+  state_type m_num_dense = 0;
+
+  std::vector<state_type> m_dense;        // m_num_dense x num_classes() complete rows
+  std::vector<state_type> m_edge_offsets; // Sparse edges of state s are [m_edge_offsets[s], m_edge_offsets[s + 1])
+  std::vector<symbol_type> m_edge_symbols;
+  std::vector<state_type> m_edge_targets;
+  std::vector<state_type> m_failure;
+  std::vector<state_type> m_needle_of;
+  std::vector<state_type> m_dict_link;
+  std::vector<state_type> m_canonical;
+  std::size_t m_max_needle_length = 0;
+
+  // Trie with per-state sorted edge lists, states are numbered in insertion order
+  struct sparse_trie {
+    std::vector<std::vector<std::pair<symbol_type, state_type>>> edges{1};
+    std::vector<state_type> needle_of{no_needle};
+
+    state_type find(state_type state, symbol_type symbol) const {
+      const auto &list = edges[state];
+      auto found = std::lower_bound(list.begin(), list.end(), std::make_pair(symbol, state_type{0}));
+      return (found != list.end() && found->first == symbol ? found->second : root);
+    }
+
+    state_type insert(state_type state, symbol_type symbol) {
+      auto &list = edges[state];
+      auto found = std::lower_bound(list.begin(), list.end(), std::make_pair(symbol, state_type{0}));
+      if (found != list.end() && found->first == symbol) return found->second;
+
+      const auto created = static_cast<state_type>(edges.size());
+      list.insert(found, std::make_pair(symbol, created));
+      edges.emplace_back();
+      needle_of.push_back(no_needle);
+      return created;
+    }
+  };
+
+  state_type find_edge(state_type state, unsigned symbol) const {
+    const auto start = m_edge_symbols.begin() + m_edge_offsets[state];
+    const auto finish = m_edge_symbols.begin() + m_edge_offsets[state + 1];
+    auto found = std::lower_bound(start, finish, symbol);
+    return (found != finish && *found == symbol ? m_edge_targets[found - m_edge_symbols.begin()] : root);
+  }
+
+  void build(const sparse_trie &trie, unsigned dense_depth) {
+    const auto num_states = trie.edges.size();
+
+    // Renumber states in breadth-first order, so that dense states form a prefix and parents precede children
+    std::vector<state_type> order{root}, renumbered(num_states), depth(num_states, 0);
+    order.reserve(num_states);
+    for (std::size_t head = 0; head < order.size(); ++head) {
+      const auto old = order[head];
+      renumbered[old] = static_cast<state_type>(head);
+      for (auto [symbol, child] : trie.edges[old]) {
+        depth[child] = depth[old] + 1;
+        order.push_back(child);
+      }
+    }
+
+    m_num_dense = static_cast<state_type>(
+        std::find_if(order.begin(), order.end(), [&](auto s) { return depth[s] >= dense_depth; }) - order.begin()
+    );
+    const auto max_dense = static_cast<state_type>(std::max<std::size_t>(max_dense_entries / num_classes(), 1));
+    m_num_dense = std::min(m_num_dense, max_dense);
+
+    m_edge_offsets.assign(1, 0);
+    m_needle_of.resize(num_states);
+    for (auto old : order) {
+      for (auto [symbol, child] : trie.edges[old]) {
+        m_edge_symbols.push_back(symbol);
+        m_edge_targets.push_back(renumbered[child]);
+      }
+      m_edge_offsets.push_back(static_cast<state_type>(m_edge_symbols.size()));
+      m_needle_of[renumbered[old]] = trie.needle_of[old];
+    }
+
+    m_failure.assign(num_states, root);
+    m_dict_link.assign(num_states, root);
+    m_dense.assign(std::size_t{m_num_dense} * num_classes(), root);
+
+    for (state_type state = 0; state < num_states; ++state) {
+      const auto fail = m_failure[state];
+      if (state != root) m_dict_link[state] = (m_needle_of[fail] != no_needle ? fail : m_dict_link[fail]);
+
+      for (auto e = m_edge_offsets[state]; e < m_edge_offsets[state + 1]; ++e) {
+        const auto child = m_edge_targets[e];
+        m_failure[child] = (state == root ? root : next_class(fail, m_edge_symbols[e]));
+      }
+
+      if (state < m_num_dense) {
+        for (unsigned c = 0; c < num_classes(); ++c) {
+          const auto edge = find_edge(state, c);
+          m_dense[state * num_classes() + c] = (edge != root || state == root ? edge : next_class(fail, c));
+        }
+      }
+    }
+  }
+
+public:
+  basic_compressed_automaton() = default;
+
+  template <typename It>
+  basic_compressed_automaton(
+      It needles_start, It needles_finish, const Classes &classes = Classes::identity(),
+      unsigned dense_depth = default_dense_depth
+  )
+      : m_classes{classes.compact(needles_start, needles_finish)} {
+    sparse_trie trie;
+
+    for (state_type index = 0; needles_start != needles_finish; ++needles_start, ++index) {
+      const auto &needle = *needles_start;
+      if (needle.empty()) throw std::invalid_argument{"Empty needles are not allowed"};
+
+      state_type curr = root;
+      for (element_type element : needle) {
+        curr = trie.insert(curr, static_cast<symbol_type>(m_classes(element)));
+      }
+
+      if (trie.needle_of[curr] == no_needle) trie.needle_of[curr] = index;
+      m_canonical.push_back(trie.needle_of[curr]);
+      m_max_needle_length = std::max(m_max_needle_length, needle.size());
+    }
+
+    build(trie, std::max(dense_depth, 1u));
+  }
+
+  // Transition over an already translated symbol. Dense states answer immediately, sparse ones fall back to their
+  // failure state until an edge is found. The root is always dense, so the loop terminates.
+  state_type next_class(state_type state, unsigned symbol) const {
+    while (state >= m_num_dense) {
+      if (auto edge = find_edge(state, symbol); edge != root) return edge;
+      state = m_failure[state];
+    }
+    return m_dense[state * num_classes() + symbol];
+  }
+
+  state_type next(state_type state, element_type element) const { return next_class(state, m_classes(element)); }
+  state_type first_output(state_type state) const {
+    return (m_needle_of[state] != no_needle ? state : m_dict_link[state]);
+  }
+
+  // Counts over the whole elements of the haystack, a trailing partial element is ignored
+  std::vector<unsigned> count(std::string_view haystack) const {
+    std::vector<unsigned> counts(num_needles(), 0);
+
+    state_type state = root;
+    for (std::size_t i = 0; i < haystack.size() / sizeof(element_type); ++i) {
+      state = next(state, load_element<element_type>(haystack, i));
+      for (auto o = first_output(state); o != root; o = m_dict_link[o]) {
+        ++counts[m_needle_of[o]];
+      }
+    }
+
+    return expand_counts(counts);
+  }
+
+  template <typename T> std::vector<T> expand_counts(const std::vector<T> &canonical_counts) const {
+    std::vector<T> counts(num_needles());
+    std::transform(m_canonical.begin(), m_canonical.end(), counts.begin(), [&](auto c) {
+      return canonical_counts[c];
+    });
+    return counts;
+  }
+
+  const Classes &classes() const { return m_classes; }
+  const std::vector<state_type> &dense() const { return m_dense; }
+  const std::vector<state_type> &edge_offsets() const { return m_edge_offsets; }
+  const std::vector<symbol_type> &edge_symbols() const { return m_edge_symbols; }
+  const std::vector<state_type> &edge_targets() const { return m_edge_targets; }
+  const std::vector<state_type> &failure() const { return m_failure; }
+  const std::vector<state_type> &needle_of() const { return m_needle_of; }
+  const std::vector<state_type> &dict_link() const { return m_dict_link; }
+
+  state_type num_states() const { return static_cast<state_type>(m_needle_of.size()); }
+  state_type num_dense() const { return m_num_dense; }
+  unsigned num_classes() const { return m_classes.size(); }
+  std::size_t num_needles() const { return m_canonical.size(); }
+  std::size_t max_needle_length() const { return m_max_needle_length; }
+
+  std::size_t footprint() const {
+    return sizeof(state_type) * (m_dense.size() + m_edge_offsets.size() + m_edge_targets.size() + m_failure.size() +
+                                 m_needle_of.size() + m_dict_link.size()) +
+           sizeof(symbol_type) * m_edge_symbols.size() + m_classes.footprint();
+  }
+};
+
+using compressed_automaton = basic_compressed_automaton<byte_classes>;
+template <typename Symbol> using token_automaton = basic_compressed_automaton<symbol_classes<Symbol>>;
+
+} // namespace matching
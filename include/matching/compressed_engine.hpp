@@ -0,0 +1,98 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "compressed_automaton.hpp"
+#include "device.hpp"
+#include "engine.hpp"
+
+#include "kernelhpp/compressed_ac_kernel.hpp"
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace matching {
+
+// Chunked Aho-Corasick scan over the compressed automaton representation. The kernel is specialized for the element
+// type of the automaton, and a haystack of wide symbols comes as their raw bytes with chunks counted in symbols.
+template <typename Classes> class basic_compressed_engine : public engine {
+  using automaton_type = basic_compressed_automaton<Classes>;
+  using element_type = typename automaton_type::element_type;
+
+  const device_context &m_ctx;
+  automaton_type m_automaton;
+  unsigned m_chunk_size;
+
+  cl::Program m_program;
+  cl::Kernel m_kernel;
+  device_array m_classes, m_dense, m_edge_offsets, m_edge_symbols, m_edge_targets, m_failure, m_needle_of, m_dict_link;
+
+public:
+  basic_compressed_engine(const device_context &ctx, automaton_type dfa, unsigned chunk_size = default_chunk_size)
+      : m_ctx{ctx}, m_automaton{std::move(dfa)}, m_chunk_size{chunk_size},
+        m_program{m_ctx.build_program(compressed_ac_kernel::source(
+            m_automaton.num_classes(), m_automaton.num_dense(),
+            static_cast<unsigned>(m_automaton.max_needle_length() - 1), unsigned{sizeof(element_type)},
+            static_cast<unsigned>(m_automaton.classes().table_size())
+        ))},
+        m_kernel{m_program, compressed_ac_kernel::entry().c_str()},
+        m_classes{m_ctx, m_automaton.classes().table()},
+        m_dense{m_ctx, m_automaton.dense()},
+        m_edge_offsets{m_ctx, m_automaton.edge_offsets()},
+        m_edge_symbols{m_ctx, m_automaton.edge_symbols()},
+        m_edge_targets{m_ctx, m_automaton.edge_targets()},
+        m_failure{m_ctx, m_automaton.failure()},
+        m_needle_of{m_ctx, m_automaton.needle_of()},
+        m_dict_link{m_ctx, m_automaton.dict_link()} {}
+
+  match_result match(std::string_view haystack) override {
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+    std::vector<cl_uint> counts(m_automaton.num_needles(), 0);
+
+    if (haystack.size() % sizeof(element_type)) {
+      throw std::invalid_argument{"Haystack is not a whole number of " + std::to_string(sizeof(element_type)) +
+                                  "-byte symbols"};
+    }
+    if (haystack.empty()) return {m_automaton.expand_counts(counts), {}};
+
+    const auto length = haystack.size() / sizeof(element_type);
+    const auto num_chunks = (length + m_chunk_size - 1) / m_chunk_size;
+    const auto haystack_size = haystack_length(length, num_chunks, m_chunk_size);
+
+    const auto [device, event] = count_matches(
+        m_ctx, haystack, counts.size(),
+        [&](const auto &deps, const auto &haystack_arg, const auto &counts_arg) {
+          return launch_kernel(
+              m_ctx.queue(), m_kernel, deps, cl::NDRange{num_chunks}, haystack_arg, haystack_size, m_chunk_size,
+              m_classes, m_dense, m_edge_offsets, m_edge_symbols, m_edge_targets, m_failure, m_needle_of, m_dict_link,
+              counts_arg
+          );
+        }
+    );
+
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+    return {
+        m_automaton.expand_counts(device),
+        {to_millis(event_duration(event)), to_millis(wall_end - wall_start)}
+    };
+  }
+
+  std::string name() const override { return "ac-compressed"; }
+  std::size_t footprint() const override { return m_automaton.footprint(); }
+};
+
+using compressed_engine = basic_compressed_engine<byte_classes>;
+template <typename Symbol> using token_engine = basic_compressed_engine<symbol_classes<Symbol>>;
+
+} // namespace matching
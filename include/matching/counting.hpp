@@ -0,0 +1,84 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "common/opencl_include.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+namespace matching {
+
+// Where kernels add up their hits. With `global` every hit is an atomic on the global counters, which serializes the
+// device when a few needles match all the time. The local strategies count into a per-work-group table in `__local`
+// memory and merge it into the global counters once per group: `local` keeps a counter for every needle, `local_hash`
+// an open-addressing table for dictionaries too large for that, spilling to the global counters when a probe
+// sequence is full. Values match the COUNT_* macros of the kernels.
+enum class counting {
+  automatic = -1,
+  global = 0,
+  local = 1,
+  local_hash = 2
+};
+
+inline counting parse_counting(const std::string &name) {
+  if (name == "auto") return counting::automatic;
+  if (name == "global") return counting::global;
+  if (name == "local") return counting::local;
+  if (name == "local-hash") return counting::local_hash;
+  throw std::invalid_argument{"Unknown counting strategy " + name};
+}
+
+inline std::string to_string(counting strategy) {
+  switch (strategy) {
+  case counting::global: return "global";
+  case counting::local: return "local";
+  case counting::local_hash: return "local-hash";
+  default: return "auto";
+  }
+}
+
+struct counting_plan {
+  counting strategy;
+  unsigned table_size; // Counters of the local table, or slots of the hash table (a power of two)
+};
+
+// A local table may take half of the local memory, so that two work-groups still fit on a compute unit
+inline counting_plan
+choose_counting(std::size_t num_counters, const cl::Device &device, counting requested = counting::automatic) {
+  static constexpr std::size_t min_hash_slots = 256;
+
+  const auto budget = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>() / 2;
+  const bool dense_fits = num_counters * sizeof(cl_uint) <= budget;
+  const auto slots = std::bit_floor(budget / (2 * sizeof(cl_uint)));
+
+  if (requested == counting::automatic) {
+    if (dense_fits) return {counting::local, static_cast<unsigned>(std::max<std::size_t>(num_counters, 1))};
+    if (slots >= min_hash_slots) return {counting::local_hash, static_cast<unsigned>(slots)};
+    return {counting::global, 1};
+  }
+
+  if (requested == counting::local && !dense_fits) {
+    throw std::invalid_argument{"Local counters for every needle do not fit into local memory"};
+  }
+  if (requested == counting::local_hash && slots == 0) throw std::invalid_argument{"Device has no local memory"};
+
+  switch (requested) {
+  case counting::local: return {counting::local, static_cast<unsigned>(std::max<std::size_t>(num_counters, 1))};
+  case counting::local_hash: return {counting::local_hash, static_cast<unsigned>(slots)};
+  default: return {counting::global, 1};
+  }
+}
+
+} // namespace matching
@@ -0,0 +1,169 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "common/buffer_pool.hpp"
+#include "common/opencl_include.hpp"
+#include "common/pinned_allocator.hpp"
+#include "common/selector.hpp"
+#include "common/svm_memory.hpp"
+#include "residency_cache.hpp"
+
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace matching {
+
+// Host buffer that the device can transfer from without an intermediate copy, or read in place in SVM mode
+using pinned_buffer = std::vector<char, clutils::pinned_allocator<char>>;
+
+// How haystacks and automata reach the device: copied into buffers, or shared through fine-grained SVM. Coarse-grained
+// SVM is not used, since it needs the same map/unmap round trip per job as pinned buffers.
+enum class memory_mode {
+  automatic,
+  buffer,
+  svm
+};
+
+inline memory_mode parse_memory_mode(const std::string &name) {
+  if (name == "auto") return memory_mode::automatic;
+  if (name == "buffer") return memory_mode::buffer;
+  if (name == "svm") return memory_mode::svm;
+  throw std::invalid_argument{"Unknown memory mode " + name};
+}
+
+inline std::string to_string(memory_mode mode) {
+  switch (mode) {
+  case memory_mode::buffer: return "buffer";
+  case memory_mode::svm: return "svm";
+  default: return "auto";
+  }
+}
+
+inline cl_device_svm_capabilities svm_capabilities(const cl::Device &device) {
+  const auto version = clutils::decode_platform_version(device.getInfo<CL_DEVICE_VERSION>()).ver;
+  if (version < clutils::platform_version{2, 0}) return 0;
+  return device.getInfo<CL_DEVICE_SVM_CAPABILITIES>();
+}
+
+inline bool supports_opencl_c2(const cl::Device &device) {
+  const auto version = clutils::decode_platform_version(device.getInfo<CL_DEVICE_OPENCL_C_VERSION>()).ver;
+  return version >= clutils::platform_version{2, 0};
+}
+
+inline bool supports_fine_grained_svm(const cl::Device &device) {
+  return svm_capabilities(device) & (CL_DEVICE_SVM_FINE_GRAIN_BUFFER | CL_DEVICE_SVM_FINE_GRAIN_SYSTEM);
+}
+
+// Sub-group built-ins (reductions, scans, broadcasts) come with cl_khr_subgroups, which extends OpenCL C 2.0, or with
+// cl_intel_subgroups, which also works in 1.2 kernels. Kernels take them through their SUBGROUPS macro.
+enum class subgroups {
+  none,
+  khr,
+  intel
+};
+
+inline subgroups subgroup_support(const cl::Device &device) {
+  const std::vector<std::string> intel{"cl_intel_subgroups"}, khr{"cl_khr_subgroups"};
+  if (clutils::device_supports_extensions(device, intel.begin(), intel.end()).first) return subgroups::intel;
+  if (supports_opencl_c2(device) && clutils::device_supports_extensions(device, khr.begin(), khr.end()).first) {
+    return subgroups::khr;
+  }
+  return subgroups::none;
+}
+
+// Selected platform and device together with a context, a profiling-enabled queue, a buffer pool and a host memory
+// resource shared by all engines. In SVM mode host allocations are fine-grained SVM and kernels take them in place.
+class device_context : public clutils::platform_selector {
+  cl::Context m_context;
+  cl::CommandQueue m_queue;
+  mutable clutils::buffer_pool m_pool;
+  memory_mode m_mode;
+  matching::subgroups m_subgroups;
+  std::shared_ptr<clutils::host_memory_resource> m_host;
+  std::unique_ptr<residency_cache> m_residency;
+
+  memory_mode resolve_mode(memory_mode requested) const {
+    const bool svm = supports_fine_grained_svm(m_device);
+    if (requested == memory_mode::svm && !svm) throw std::runtime_error{"Device does not support fine-grained SVM"};
+    if (requested == memory_mode::automatic) return (svm ? memory_mode::svm : memory_mode::buffer);
+    return requested;
+  }
+
+  std::shared_ptr<clutils::host_memory_resource> make_host_resource() const {
+    if (m_mode == memory_mode::buffer) return std::make_shared<clutils::pinned_memory_resource>(m_context, m_queue);
+    const bool system = svm_capabilities(m_device) & CL_DEVICE_SVM_FINE_GRAIN_SYSTEM;
+    return std::make_shared<clutils::svm_memory_resource>(m_context, system);
+  }
+
+public:
+  static constexpr clutils::platform_version min_version = {1, 2};
+
+  device_context(
+      bool verbose = false, memory_mode mode = memory_mode::automatic, cl_device_type device_type = CL_DEVICE_TYPE_GPU
+  )
+      : platform_selector{min_version, verbose, default_pred, default_pred, device_type}, m_context{m_device},
+        m_queue{m_context, m_device, CL_QUEUE_PROFILING_ENABLE}, m_pool{m_context, m_device},
+        m_mode{resolve_mode(mode)}, m_subgroups{subgroup_support(m_device)}, m_host{make_host_resource()} {
+    if (verbose) std::cout << "Info: Memory mode: " << to_string(m_mode) << "\n";
+  }
+
+  // Separate context for an already known device, e.g. one NUMA node of a partitioned CPU
+  device_context(cl::Platform platform, cl::Device device, memory_mode mode = memory_mode::automatic)
+      : platform_selector{std::move(platform), std::move(device)}, m_context{m_device},
+        m_queue{m_context, m_device, CL_QUEUE_PROFILING_ENABLE}, m_pool{m_context, m_device},
+        m_mode{resolve_mode(mode)}, m_subgroups{subgroup_support(m_device)}, m_host{make_host_resource()} {}
+
+  // SVM pointers as kernel arguments need OpenCL C 2.0, kernels using 2.0 atomics ask for it with `needs_cl2`, and so
+  // do kernels using cl_khr_subgroups with `uses_subgroups`
+  cl::Program build_program(const std::string &source, bool needs_cl2 = false, bool uses_subgroups = false) const {
+    cl::Program program{m_context, source};
+
+    try {
+      const bool khr = (uses_subgroups && m_subgroups == matching::subgroups::khr);
+      const bool cl2 = needs_cl2 || khr || m_mode == memory_mode::svm;
+      program.build(std::vector<cl::Device>{m_device}, (cl2 ? "-cl-std=CL2.0" : ""));
+    } catch (cl::Error &e) {
+      std::cerr << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(m_device) << "\n";
+      throw;
+    }
+
+    return program;
+  }
+
+  const cl::Context &context() const { return m_context; }
+  const cl::CommandQueue &queue() const { return m_queue; }
+  const cl::Device &device() const { return m_device; }
+  const cl::Platform &platform() const { return m_platform; }
+  clutils::buffer_pool &pool() const { return m_pool; }
+
+  memory_mode mode() const { return m_mode; }
+  matching::subgroups subgroups() const { return m_subgroups; }
+  bool has_subgroups() const { return m_subgroups != matching::subgroups::none; }
+
+  // Keeps haystack files resident on the device between jobs, see residency_cache. Off unless enabled.
+  void enable_residency(std::size_t capacity = 0) {
+    m_residency = std::make_unique<residency_cache>(m_context, m_queue, m_device, capacity);
+  }
+  residency_cache *residency() const { return m_residency.get(); }
+
+  bool shares(const void *ptr, std::size_t size) const { return m_host->shares(ptr, size); }
+
+  template <typename T> clutils::pinned_allocator<T> pinned_allocator() const {
+    return clutils::pinned_allocator<T>{m_host};
+  }
+  pinned_buffer make_pinned_buffer() const { return pinned_buffer{pinned_allocator<char>()}; }
+};
+
+} // namespace matching
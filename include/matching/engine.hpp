@@ -0,0 +1,177 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "common/opencl_include.hpp"
+#include "common/utils.hpp"
+#include "device.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace matching {
+
+// Bytes scanned by a single work-item of the chunked engines
+inline constexpr unsigned default_chunk_size = 4096;
+
+struct match_result {
+  std::vector<unsigned> counts;
+  clutils::profiling_info time;
+};
+
+// Device matching engine. Engines own device copies of their automaton and count occurrences of every needle.
+class engine {
+public:
+  virtual match_result match(std::string_view haystack) = 0;
+  virtual std::string name() const = 0;
+  virtual std::size_t footprint() const = 0; // Device memory taken by the automaton, in bytes
+  virtual ~engine() = default;
+};
+
+// Read-only device copy of a host container
+template <typename T> cl::Buffer make_buffer(const cl::Context &context, const T &container) {
+  return cl::Buffer{
+      context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, clutils::sizeof_container(container),
+      const_cast<typename T::value_type *>(container.data())};
+}
+
+// Read-only automaton table as a kernel argument. In buffer mode it is a device copy (or an image), in SVM mode the
+// table is copied once into shared memory and kernels read it in place.
+class device_array {
+  cl::Memory m_memory;
+  pinned_buffer m_shared;
+
+public:
+  explicit device_array(cl::Memory memory)
+      : m_memory{std::move(memory)}, m_shared{clutils::pinned_allocator<char>{nullptr}} {}
+
+  template <typename T>
+  device_array(const device_context &ctx, const T &container) : m_shared{ctx.pinned_allocator<char>()} {
+    if (ctx.mode() != memory_mode::svm) {
+      m_memory = make_buffer(ctx.context(), container);
+      return;
+    }
+
+    const auto *first = reinterpret_cast<const char *>(container.data());
+    m_shared.assign(first, first + clutils::sizeof_container(container));
+  }
+
+  void set_arg(cl::Kernel &kernel, cl_uint index) const {
+    if (m_memory()) {
+      kernel.setArg(index, m_memory);
+    } else {
+      kernel.setArg(index, static_cast<const void *>(m_shared.data()));
+    }
+  }
+};
+
+template <typename T> void set_kernel_arg(cl::Kernel &kernel, cl_uint index, const T &arg) {
+  if constexpr (std::is_same_v<T, device_array>) {
+    arg.set_arg(kernel, index);
+  } else {
+    kernel.setArg(index, arg); // Raw pointers go in as SVM pointers
+  }
+}
+
+// Unlike cl::KernelFunctor the argument types are not fixed, so the same kernel can take buffers in one call and SVM
+// pointers in the next
+template <typename... Ts> void set_kernel_args(cl::Kernel &kernel, const Ts &...args) {
+  cl_uint index = 0;
+  (set_kernel_arg(kernel, index++, args), ...);
+}
+
+// Sets the arguments in order and enqueues the kernel behind `deps`
+template <typename... Ts>
+cl::Event launch_kernel(
+    const cl::CommandQueue &queue, cl::Kernel &kernel, const std::vector<cl::Event> &deps, cl::NDRange global,
+    const Ts &...args
+) {
+  set_kernel_args(kernel, args...);
+
+  cl::Event event;
+  queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, cl::NullRange, &deps, &event);
+  return event;
+}
+
+template <typename T> inline std::chrono::duration<double, std::milli> to_millis(T duration) {
+  return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(duration);
+}
+
+inline std::chrono::nanoseconds event_duration(const cl::Event &event) {
+  return std::chrono::nanoseconds{
+      event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>()};
+}
+
+// Kernels address the haystack with 32-bit offsets. Chunked kernels also compute the start and end of the chunk of
+// every work-item they launch, padding work-items past the last chunk included, so those have to fit as well.
+inline cl_uint haystack_length(std::size_t length, std::size_t num_work_items = 0, std::size_t chunk_size = 0) {
+  if (std::max(length, (num_work_items + 1) * chunk_size) > std::numeric_limits<cl_uint>::max()) {
+    throw std::length_error{"Haystack of " + std::to_string(length) + " symbols is too long for 32-bit offsets"};
+  }
+  return static_cast<cl_uint>(length);
+}
+
+struct device_counts {
+  std::vector<cl_uint> counts;
+  cl::Event kernel;
+};
+
+// Runs one counting pass over the haystack. The upload and the counter reset are enqueued without blocking, `launch`
+// enqueues the kernel behind both of them and the read-back is chained on the kernel event, so the host waits only
+// once. `launch(deps, haystack, counts)` must return the kernel event; haystack and counts are either buffers or, when
+// the haystack lives in shared memory, SVM pointers and there are no transfers at all. A haystack kept resident by
+// the context is not uploaded again.
+template <typename Launch>
+device_counts
+count_matches(const device_context &ctx, std::string_view haystack, std::size_t num_counters, Launch launch) {
+  if (ctx.shares(haystack.data(), haystack.size())) {
+    std::vector<cl_uint, clutils::pinned_allocator<cl_uint>> shared(num_counters, 0, ctx.pinned_allocator<cl_uint>());
+    auto kernel = launch(std::vector<cl::Event>{}, haystack.data(), shared.data());
+    kernel.wait();
+    return {std::vector<cl_uint>(shared.begin(), shared.end()), kernel};
+  }
+
+  const auto &queue = ctx.queue();
+  const auto counts_size = num_counters * sizeof(cl_uint);
+  auto counts_buf = ctx.pool().acquire(counts_size);
+
+  std::vector<cl::Event> transfers(1);
+  queue.enqueueFillBuffer(counts_buf, cl_uint{0}, 0, counts_size, nullptr, &transfers[0]);
+
+  const cl::Buffer *resident = (ctx.residency() ? ctx.residency()->find(haystack) : nullptr);
+  clutils::buffer_pool::handle haystack_buf;
+  if (!resident) {
+    haystack_buf = ctx.pool().acquire(haystack.size());
+    queue.enqueueWriteBuffer(
+        haystack_buf, CL_FALSE, 0, haystack.size(), haystack.data(), nullptr, &transfers.emplace_back()
+    );
+  }
+
+  const auto &haystack_arg = (resident ? *resident : haystack_buf.buffer());
+  device_counts result{std::vector<cl_uint>(num_counters), launch(transfers, haystack_arg, counts_buf.buffer())};
+
+  const std::vector<cl::Event> kernel{result.kernel};
+  cl::Event read;
+  queue.enqueueReadBuffer(counts_buf, CL_FALSE, 0, counts_size, result.counts.data(), &kernel, &read);
+  read.wait();
+
+  return result;
+}
+
+} // namespace matching
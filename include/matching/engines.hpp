@@ -0,0 +1,70 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "aho_corasick.hpp"
+#include "aho_corasick_engine.hpp"
+#include "alphabet.hpp"
+#include "compressed_automaton.hpp"
+#include "compressed_engine.hpp"
+#include "device.hpp"
+#include "engine.hpp"
+#include "persistent_engine.hpp"
+#include "pfac_engine.hpp"
+#include "two_way.hpp"
+#include "two_way_engine.hpp"
+
+#include <array>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace matching {
+
+inline constexpr std::array engine_names = {"ac", "pfac", "ac-compressed"};
+
+// Also accepted by make_engine but left out of the comparisons: it keeps a kernel running for its whole lifetime
+inline constexpr std::string_view persistent_engine_name = "ac-persistent";
+
+// Single-needle engine, which the planner picks whenever the dictionary has one entry
+inline constexpr std::string_view two_way_engine_name = "two-way";
+
+// Every engine builds the automaton representation it runs on. Builds of the full DFA fill `report` when given.
+inline std::unique_ptr<engine> make_engine(
+    std::string_view name, const device_context &ctx, const std::vector<std::string> &needles,
+    const byte_classes &classes = byte_classes::identity(), unsigned chunk_size = default_chunk_size,
+    build_report *report = nullptr
+) {
+  if (needles.empty()) throw std::invalid_argument{"Dictionary is empty"};
+
+  const auto first = needles.begin(), last = needles.end();
+
+  if (name == "ac") {
+    return std::make_unique<aho_corasick_engine>(ctx, automaton{first, last, classes, report}, chunk_size);
+  }
+  if (name == "pfac") return std::make_unique<pfac_engine>(ctx, automaton{first, last, classes, report});
+  if (name == "ac-compressed") {
+    return std::make_unique<compressed_engine>(ctx, compressed_automaton{first, last, classes}, chunk_size);
+  }
+  if (name == persistent_engine_name) {
+    return std::make_unique<persistent_engine>(ctx, automaton{first, last, classes, report}, chunk_size);
+  }
+  if (name == two_way_engine_name) {
+    if (needles.size() != 1) throw std::invalid_argument{"Engine two-way takes a dictionary of a single needle"};
+    return std::make_unique<two_way_engine>(ctx, two_way_needle{needles.front(), classes}, chunk_size);
+  }
+
+  throw std::invalid_argument{"Unknown engine " + std::string{name}};
+}
+
+} // namespace matching
@@ -0,0 +1,94 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "device.hpp"
+#include "engine.hpp"
+#include "fm_index.hpp"
+
+#include "kernelhpp/fm_index_kernel.hpp"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace matching {
+
+// Answers needle counts from an FM-index kept on the device instead of scanning the haystack. A batch of needles is
+// uploaded at once and every work-item runs the backward search of one needle, so a query costs O(|needle|) block
+// scans however large the indexed text is. The suffix array stays on the host, counting does not need it.
+class fm_engine {
+  const device_context &m_ctx;
+  const fm_index &m_index;
+
+  cl::Program m_program;
+  cl::Kernel m_kernel;
+  device_array m_bwt, m_checkpoints, m_first, m_symbol_of;
+
+public:
+  fm_engine(const device_context &ctx, const fm_index &index)
+      : m_ctx{ctx}, m_index{index},
+        m_program{m_ctx.build_program(fm_index_kernel::source(m_index.block_size(), m_index.sigma()))},
+        m_kernel{m_program, fm_index_kernel::entry().c_str()},
+        m_bwt{m_ctx, m_index.bwt()},
+        m_checkpoints{m_ctx, m_index.checkpoints()},
+        m_first{m_ctx, m_index.first()},
+        m_symbol_of{m_ctx, m_index.symbol_of()} {}
+
+  match_result count(const std::vector<std::string> &needles) {
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+    if (needles.empty()) return {};
+
+    std::string packed;
+    std::vector<cl_uint> offsets{0};
+    for (const auto &needle : needles) {
+      packed += needle;
+      offsets.push_back(static_cast<cl_uint>(packed.size()));
+    }
+
+    const auto &queue = m_ctx.queue();
+    const auto num_needles = static_cast<cl_uint>(needles.size());
+    const auto counts_size = needles.size() * sizeof(cl_uint);
+    auto packed_buf = m_ctx.pool().acquire(packed.size());
+    auto offsets_buf = m_ctx.pool().acquire(offsets.size() * sizeof(cl_uint));
+    auto counts_buf = m_ctx.pool().acquire(counts_size);
+
+    std::vector<cl::Event> uploads(2);
+    queue.enqueueWriteBuffer(packed_buf, CL_FALSE, 0, packed.size(), packed.data(), nullptr, &uploads[0]);
+    queue.enqueueWriteBuffer(
+        offsets_buf, CL_FALSE, 0, offsets.size() * sizeof(cl_uint), offsets.data(), nullptr, &uploads[1]
+    );
+
+    const std::vector<cl::Event> kernel{launch_kernel(
+        queue, m_kernel, uploads, cl::NDRange{needles.size()}, packed_buf.buffer(), offsets_buf.buffer(),
+        num_needles, m_bwt, m_checkpoints, m_first, m_symbol_of, static_cast<cl_uint>(m_index.rows()),
+        static_cast<cl_uint>(m_index.dollar()), counts_buf.buffer()
+    )};
+
+    std::vector<cl_uint> counts(needles.size());
+    cl::Event read;
+    queue.enqueueReadBuffer(counts_buf, CL_FALSE, 0, counts_size, counts.data(), &kernel, &read);
+    read.wait();
+
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+    return {
+        std::vector<unsigned>(counts.begin(), counts.end()),
+        {to_millis(event_duration(kernel.front())), to_millis(wall_end - wall_start)}
+    };
+  }
+
+  std::size_t footprint() const {
+    return m_index.bwt().size_bytes() + m_index.checkpoints().size_bytes() + m_index.first().size_bytes() +
+           m_index.symbol_of().size_bytes();
+  }
+};
+
+} // namespace matching
@@ -0,0 +1,389 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "aho_corasick.hpp"
+
+#include "common/mapped_file.hpp"
+#include "common/thread_pool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace matching {
+
+namespace detail {
+
+// Sorts [first, last) by splitting it between pool threads and merging the sorted runs pairwise
+template <typename It> void parallel_sort(It first, It last, clutils::thread_pool &pool) {
+  const auto size = static_cast<std::size_t>(last - first);
+  const auto run = std::max<std::size_t>(size / pool.size() + 1, 1 << 16);
+
+  pool.parallel_for(0, size, run, [&](std::size_t begin, std::size_t end) { std::sort(first + begin, first + end); });
+
+  for (auto width = run; width < size; width *= 2) {
+    pool.parallel_for(0, (size + 2 * width - 1) / (2 * width), 1, [&](std::size_t begin, std::size_t end) {
+      for (auto i = begin; i < end; ++i) {
+        const auto lo = i * 2 * width, mid = std::min(lo + width, size), hi = std::min(lo + 2 * width, size);
+        std::inplace_merge(first + lo, first + mid, first + hi);
+      }
+    });
+  }
+}
+
+} // namespace detail
+
+// Suffix array by prefix doubling. Suffixes are bucketed by their first byte; in round k every group of suffixes with
+// equal 2^k-prefixes is sorted by the rank of the suffix 2^k positions further and split where that rank changes.
+// A suffix's rank is the first position of its group, so finished suffixes keep their final position. Groups are
+// independent and are processed in parallel, large ones with a parallel sort. Sort keys are kept per position, so
+// ranks are read in the sorting pass and written only in the splitting pass.
+inline std::vector<std::uint32_t>
+build_suffix_array(std::string_view text, clutils::thread_pool &pool = clutils::default_thread_pool()) {
+  using index_type = std::uint32_t;
+  using group = std::pair<std::size_t, std::size_t>;
+  constexpr std::size_t large_group = 1 << 16, grain = 1 << 10;
+
+  const auto n = text.size();
+  if (n >= std::numeric_limits<index_type>::max()) throw std::length_error{"Text is too large to be indexed"};
+
+  std::vector<index_type> sa(n), rank(n);
+  std::array<std::size_t, 257> bucket{};
+  for (unsigned char c : text) {
+    ++bucket[c + 1];
+  }
+  std::partial_sum(bucket.begin(), bucket.end(), bucket.begin());
+
+  auto next = bucket;
+  for (std::size_t i = 0; i < n; ++i) {
+    const auto c = static_cast<unsigned char>(text[i]);
+    sa[next[c]++] = static_cast<index_type>(i);
+    rank[i] = static_cast<index_type>(bucket[c]);
+  }
+
+  std::vector<group> groups;
+  for (std::size_t c = 0; c < 256; ++c) {
+    if (bucket[c + 1] - bucket[c] > 1) groups.emplace_back(bucket[c], bucket[c + 1]);
+  }
+
+  // Key of a position: rank of the suffix k further (0 past the end) in the upper half, the suffix in the lower one
+  std::vector<std::uint64_t> keys(n);
+  const auto split = [&](const group &g, std::vector<group> &found) {
+    for (auto begin = g.first; begin < g.second;) {
+      auto end = begin + 1;
+      while (end < g.second && keys[end] >> 32 == keys[begin] >> 32) {
+        ++end;
+      }
+      for (auto p = begin; p < end; ++p) {
+        rank[sa[p]] = static_cast<index_type>(begin);
+      }
+      if (end - begin > 1) found.emplace_back(begin, end);
+      begin = end;
+    }
+  };
+
+  for (std::size_t k = 1; !groups.empty(); k *= 2) {
+    const auto fill_keys = [&](const group &g) {
+      for (auto p = g.first; p < g.second; ++p) {
+        const std::uint64_t next_rank = (sa[p] + k < n ? rank[sa[p] + k] + 1 : 0);
+        keys[p] = next_rank << 32 | sa[p];
+      }
+    };
+    const auto store = [&](const group &g) {
+      for (auto p = g.first; p < g.second; ++p) {
+        sa[p] = static_cast<index_type>(keys[p]);
+      }
+    };
+
+    const auto first_small = std::stable_partition(groups.begin(), groups.end(), [](const group &g) {
+      return g.second - g.first >= large_group;
+    });
+
+    for (auto g = groups.begin(); g != first_small; ++g) {
+      fill_keys(*g);
+      detail::parallel_sort(keys.begin() + g->first, keys.begin() + g->second, pool);
+      store(*g);
+    }
+
+    const auto small = static_cast<std::size_t>(first_small - groups.begin());
+    pool.parallel_for(small, groups.size(), grain, [&](std::size_t first, std::size_t last) {
+      for (auto g = first; g < last; ++g) {
+        fill_keys(groups[g]);
+        std::sort(keys.begin() + groups[g].first, keys.begin() + groups[g].second);
+        store(groups[g]);
+      }
+    });
+
+    std::vector<std::vector<group>> found((groups.size() + grain - 1) / grain);
+    pool.parallel_for(0, groups.size(), grain, [&](std::size_t first, std::size_t last) {
+      for (auto g = first; g < last; ++g) {
+        split(groups[g], found[first / grain]);
+      }
+    });
+
+    groups.clear();
+    for (auto &part : found) {
+      groups.insert(groups.end(), part.begin(), part.end());
+    }
+  }
+
+  return sa;
+}
+
+// FM-index of a text: its Burrows-Wheeler transform with occurrence checkpoints, and the suffix array. Rows are the
+// n + 1 suffixes of text + '$' in sorted order, row 0 being the lone '$'. The '$' inside the BWT is stored as a zero
+// byte at row dollar() and skipped when counting. Only bytes present in the text get a symbol, and checkpoints
+// store the count of every symbol before each block of block_size() rows, so occ() scans at most one block.
+//
+// The index is a single byte image laid out as the file it is saved to, and a loaded index maps that file instead of
+// reading it: header, symbol_of[256], first[sigma], checkpoints[num_blocks * sigma], suffix array[n], bwt[n + 1].
+class fm_index {
+public:
+  using index_type = std::uint32_t;
+  static constexpr index_type no_symbol = std::numeric_limits<index_type>::max();
+  static constexpr index_type default_block_size = 128;
+
+private:
+  struct header {
+    char magic[8];
+    std::uint64_t text_size;
+    index_type block_size, sigma, dollar, reserved;
+  };
+
+  static constexpr char magic[8] = {'F', 'M', 'I', 'N', 'D', 'E', 'X', '1'};
+
+  std::vector<char> m_storage;
+  std::optional<clutils::mapped_file> m_file;
+  std::string_view m_image;
+
+  header m_header{};
+  std::span<const index_type> m_symbol_of, m_first, m_checkpoints, m_suffix_array;
+  std::span<const unsigned char> m_bwt;
+
+  static std::size_t align(std::size_t offset) { return (offset + 7) / 8 * 8; }
+
+  // Section sizes in bytes, in file order
+  static std::array<std::size_t, 5> layout(const header &h) {
+    const auto rows = h.text_size + 1;
+    const auto num_blocks = rows / h.block_size + 1;
+    return {
+        256 * sizeof(index_type), h.sigma * sizeof(index_type), num_blocks * h.sigma * sizeof(index_type),
+        h.text_size * sizeof(index_type), rows};
+  }
+
+  static std::size_t image_size(const header &h) {
+    auto size = align(sizeof(header));
+    for (auto section : layout(h)) {
+      size = align(size + section);
+    }
+    return size;
+  }
+
+  void attach(std::string_view image) {
+    if (image.size() < sizeof(header)) throw std::runtime_error{"Index file is truncated"};
+    std::memcpy(&m_header, image.data(), sizeof(header));
+    if (std::memcmp(m_header.magic, magic, sizeof(magic)) != 0) throw std::runtime_error{"Not an index file"};
+    if (image.size() < image_size(m_header)) throw std::runtime_error{"Index file is truncated"};
+
+    m_image = image;
+    const auto sizes = layout(m_header);
+    std::array<const char *, 5> sections{};
+    for (std::size_t i = 0, offset = align(sizeof(header)); i < sections.size(); offset = align(offset + sizes[i++])) {
+      sections[i] = image.data() + offset;
+    }
+
+    const auto words = [&](std::size_t i) {
+      return std::span{reinterpret_cast<const index_type *>(sections[i]), sizes[i] / sizeof(index_type)};
+    };
+    m_symbol_of = words(0);
+    m_first = words(1);
+    m_checkpoints = words(2);
+    m_suffix_array = words(3);
+    m_bwt = std::span{reinterpret_cast<const unsigned char *>(sections[4]), sizes[4]};
+  }
+
+  template <typename T> T *section(std::size_t i) {
+    const auto sizes = layout(m_header);
+    auto offset = align(sizeof(header));
+    for (std::size_t s = 0; s < i; ++s) {
+      offset = align(offset + sizes[s]);
+    }
+    return reinterpret_cast<T *>(m_storage.data() + offset);
+  }
+
+  fm_index() = default;
+
+public:
+  static fm_index build(
+      std::string_view text, clutils::thread_pool &pool = clutils::default_thread_pool(),
+      index_type block_size = default_block_size, build_report *report = nullptr
+  ) {
+    auto phase_start = std::chrono::high_resolution_clock::now();
+    const auto end_phase = [&](const char *name, std::size_t bytes) {
+      const auto now = std::chrono::high_resolution_clock::now();
+      if (report) {
+        report->phases.push_back(
+            {name, std::chrono::duration_cast<std::chrono::milliseconds>(now - phase_start), bytes}
+        );
+      }
+      phase_start = now;
+    };
+
+    const auto sa = build_suffix_array(text, pool);
+    end_phase("suffix array", sa.size() * (2 * sizeof(index_type) + sizeof(std::uint64_t)));
+
+    fm_index index;
+    std::array<std::uint64_t, 256> histogram{};
+    for (unsigned char c : text) {
+      ++histogram[c];
+    }
+
+    index.m_header = {{}, text.size(), block_size, 0, 0, 0};
+    std::memcpy(index.m_header.magic, magic, sizeof(magic));
+    std::array<index_type, 256> symbol_of;
+    symbol_of.fill(no_symbol);
+    for (std::size_t c = 0; c < 256; ++c) {
+      if (histogram[c]) symbol_of[c] = index.m_header.sigma++;
+    }
+
+    const auto rows = text.size() + 1;
+    const auto num_blocks = rows / block_size + 1;
+    index.m_header.dollar = static_cast<index_type>(std::find(sa.begin(), sa.end(), 0) - sa.begin() + 1);
+    if (text.empty()) index.m_header.dollar = 0;
+
+    index.m_storage.assign(image_size(index.m_header), 0);
+    std::memcpy(index.m_storage.data(), &index.m_header, sizeof(header));
+    std::copy(symbol_of.begin(), symbol_of.end(), index.section<index_type>(0));
+
+    auto *first = index.section<index_type>(1);
+    for (std::size_t c = 0, total = 1; c < 256; ++c) {
+      if (symbol_of[c] != no_symbol) first[symbol_of[c]] = static_cast<index_type>(total);
+      total += histogram[c];
+    }
+
+    std::copy(sa.begin(), sa.end(), index.section<index_type>(3));
+
+    // Row 0 is the '$' suffix, row r > 0 is suffix sa[r - 1] preceded by the byte before it
+    auto *bwt = index.section<unsigned char>(4);
+    pool.parallel_for(0, rows, 1 << 20, [&](std::size_t begin, std::size_t end) {
+      for (auto r = begin; r < end; ++r) {
+        const auto suffix = (r == 0 ? text.size() : sa[r - 1]);
+        bwt[r] = (suffix == 0 ? 0 : static_cast<unsigned char>(text[suffix - 1]));
+      }
+    });
+
+    // Counts per block in parallel, then a running sum over the blocks of every symbol
+    const auto sigma = index.m_header.sigma;
+    auto *checkpoints = index.section<index_type>(2);
+    pool.parallel_for(1, num_blocks, 64, [&](std::size_t begin, std::size_t end) {
+      for (auto b = begin; b < end; ++b) {
+        auto *counts = checkpoints + b * sigma;
+        for (auto r = (b - 1) * block_size; r < std::min<std::size_t>(b * block_size, rows); ++r) {
+          if (r != index.m_header.dollar) ++counts[symbol_of[bwt[r]]];
+        }
+      }
+    });
+    for (std::size_t b = 1; b < num_blocks; ++b) {
+      for (std::size_t s = 0; s < sigma; ++s) {
+        checkpoints[b * sigma + s] += checkpoints[(b - 1) * sigma + s];
+      }
+    }
+
+    index.attach({index.m_storage.data(), index.m_storage.size()});
+    end_phase("fm-index", index.m_storage.size());
+    return index;
+  }
+
+  static fm_index load(const std::string &path) {
+    fm_index index;
+    index.m_file.emplace(path);
+    index.attach(index.m_file->data());
+    return index;
+  }
+
+  fm_index(fm_index &&rhs) noexcept
+      : m_storage{std::move(rhs.m_storage)}, m_file{std::move(rhs.m_file)}, m_header{rhs.m_header} {
+    if (!m_storage.empty()) {
+      attach({m_storage.data(), m_storage.size()});
+    } else if (m_file) {
+      attach(m_file->data());
+    }
+  }
+
+  fm_index &operator=(fm_index &&) = delete;
+
+  void save(const std::string &path) const {
+    std::ofstream os{path, std::ios::binary};
+    if (!os.write(m_image.data(), static_cast<std::streamsize>(m_image.size()))) {
+      throw std::runtime_error{"Can't write index file " + path};
+    }
+  }
+
+  // Occurrences of symbol `s` (byte `c`) in bwt[0, row)
+  std::size_t occ(index_type s, unsigned char c, std::size_t row) const {
+    const auto block = row / block_size();
+    std::size_t count = m_checkpoints[block * sigma() + s];
+    for (auto r = block * block_size(); r < row; ++r) {
+      count += (m_bwt[r] == c && r != dollar());
+    }
+    return count;
+  }
+
+  // Backward search, O(|needle|) steps of at most one block scan each
+  std::size_t count(std::string_view needle) const {
+    std::size_t sp = 0, ep = rows();
+    for (auto it = needle.rbegin(); it != needle.rend() && sp < ep; ++it) {
+      const auto c = static_cast<unsigned char>(*it);
+      const auto s = m_symbol_of[c];
+      if (s == no_symbol) return 0;
+
+      sp = m_first[s] + occ(s, c, sp);
+      ep = m_first[s] + occ(s, c, ep);
+    }
+    return (sp < ep ? ep - sp : 0);
+  }
+
+  std::vector<unsigned> count(const std::vector<std::string> &needles) const {
+    std::vector<unsigned> counts(needles.size());
+    std::transform(needles.begin(), needles.end(), counts.begin(), [this](const auto &needle) {
+      return static_cast<unsigned>(count(needle));
+    });
+    return counts;
+  }
+
+  std::size_t text_size() const { return m_header.text_size; }
+  std::size_t rows() const { return m_header.text_size + 1; }
+  index_type block_size() const { return m_header.block_size; }
+  index_type sigma() const { return m_header.sigma; }
+  index_type dollar() const { return m_header.dollar; }
+  std::size_t footprint() const { return m_image.size(); }
+
+  std::span<const index_type> symbol_of() const { return m_symbol_of; }
+  std::span<const index_type> first() const { return m_first; }
+  std::span<const index_type> checkpoints() const { return m_checkpoints; }
+  std::span<const index_type> suffix_array() const { return m_suffix_array; }
+  std::span<const unsigned char> bwt() const { return m_bwt; }
+};
+
+} // namespace matching
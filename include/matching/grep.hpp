@@ -0,0 +1,173 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "aho_corasick.hpp"
+#include "device.hpp"
+#include "engine.hpp"
+
+#include "kernelhpp/grep_kernel.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+namespace matching {
+
+// First match on a line: zero-based line number and the offset of the last byte of the match
+struct line_hit {
+  std::size_t line;
+  std::size_t position;
+};
+
+// Bounds of the line containing `position`, without the terminating newline
+inline std::string_view line_at(std::string_view haystack, std::size_t position) {
+  const auto start = (position == 0 ? 0 : haystack.rfind('\n', position - 1) + 1);
+  const auto end = std::min(haystack.find('\n', position), haystack.size());
+  return haystack.substr(start, end - start);
+}
+
+// Single-threaded host reference for line_matcher, with any automaton that has next() and first_output()
+template <typename Automaton>
+std::vector<line_hit> host_matching_lines(const Automaton &dfa, std::string_view haystack) {
+  std::vector<line_hit> hits;
+  std::size_t line = 0;
+  auto state = Automaton::root;
+
+  for (std::size_t i = 0; i < haystack.size(); ++i) {
+    state = dfa.next(state, haystack[i]);
+    const bool matched = (dfa.first_output(state) != Automaton::root);
+    if (matched && (hits.empty() || hits.back().line != line)) hits.push_back({line, i});
+    if (haystack[i] == '\n') ++line;
+  }
+
+  return hits;
+}
+
+// Line-oriented matching. A single pass over the haystack runs the DFA and records newline and match bitmaps together
+// with per-chunk line and hit counts; two prefix sums over the chunk counts give the first line number and the output
+// offset of every chunk, and a final kernel maps match bits to line numbers by counting bits of the newline bitmap.
+// The haystack is read once, the later kernels touch only the bitmaps.
+class line_matcher {
+  static constexpr unsigned word_bits = 32;
+  static constexpr unsigned scan_width = 256;
+
+  const device_context &m_ctx;
+  automaton m_automaton;
+  unsigned m_chunk_size;
+
+  cl::Program m_program;
+  cl::Kernel m_scan, m_prefix_sum, m_collect;
+  device_array m_classes, m_transitions, m_needle_of, m_dict_link;
+  std::size_t m_scan_width;
+
+  cl::Event prefix_sum(const cl::Buffer &in, const cl::Buffer &out, cl_uint n, const std::vector<cl::Event> &deps) {
+    set_kernel_args(m_prefix_sum, in, out, n);
+    cl::Event event;
+    m_ctx.queue().enqueueNDRangeKernel(
+        m_prefix_sum, cl::NullRange, cl::NDRange{m_scan_width}, cl::NDRange{m_scan_width}, &deps, &event
+    );
+    return event;
+  }
+
+public:
+  line_matcher(const device_context &ctx, automaton dfa, unsigned chunk_size = default_chunk_size)
+      : m_ctx{ctx}, m_automaton{std::move(dfa)}, m_chunk_size{chunk_size},
+        m_program{m_ctx.build_program(
+            grep_kernel::source(
+                m_automaton.num_classes(), static_cast<unsigned>(m_automaton.max_needle_length() - 1), scan_width,
+                m_ctx.has_subgroups()
+            ),
+            false, m_ctx.has_subgroups()
+        )},
+        m_scan{m_program, grep_kernel::entry().c_str()}, m_prefix_sum{m_program, "prefix_sum"},
+        m_collect{m_program, "collect_lines"},
+        m_classes{m_ctx, m_automaton.classes().table()},
+        m_transitions{m_ctx, m_automaton.transitions()},
+        m_needle_of{m_ctx, m_automaton.needle_of()},
+        m_dict_link{m_ctx, m_automaton.dict_link()},
+        m_scan_width{std::min<std::size_t>(
+            scan_width, m_prefix_sum.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(m_ctx.device())
+        )} {
+    if (m_chunk_size == 0 || m_chunk_size % word_bits != 0) {
+      throw std::invalid_argument{"Line matching needs a chunk size that is a multiple of 32"};
+    }
+  }
+
+  // One hit per matching line, in line order
+  std::vector<line_hit> match(std::string_view haystack) {
+    if (haystack.empty()) return {};
+
+    const auto &queue = m_ctx.queue();
+    const auto num_chunks = static_cast<cl_uint>((haystack.size() + m_chunk_size - 1) / m_chunk_size);
+    const auto haystack_size = haystack_length(haystack.size(), num_chunks, m_chunk_size);
+    const auto bitmap_size = (haystack.size() + word_bits - 1) / word_bits * sizeof(cl_uint);
+    const auto counts_size = num_chunks * sizeof(cl_uint);
+
+    auto newline_bits = m_ctx.pool().acquire(bitmap_size), match_bits = m_ctx.pool().acquire(bitmap_size);
+    auto chunk_lines = m_ctx.pool().acquire(counts_size), chunk_hits = m_ctx.pool().acquire(counts_size);
+    auto line_base = m_ctx.pool().acquire(counts_size + sizeof(cl_uint));
+    auto hit_offset = m_ctx.pool().acquire(counts_size + sizeof(cl_uint));
+
+    const cl::Buffer *resident = (m_ctx.residency() ? m_ctx.residency()->find(haystack) : nullptr);
+    clutils::buffer_pool::handle haystack_buf;
+    std::vector<cl::Event> upload;
+    if (!resident) {
+      haystack_buf = m_ctx.pool().acquire(haystack.size());
+      queue.enqueueWriteBuffer(
+          haystack_buf, CL_FALSE, 0, haystack.size(), haystack.data(), nullptr, &upload.emplace_back()
+      );
+    }
+
+    const auto &haystack_arg = (resident ? *resident : haystack_buf.buffer());
+    const std::vector<cl::Event> scan{launch_kernel(
+        queue, m_scan, upload, cl::NDRange{num_chunks}, haystack_arg, haystack_size, m_chunk_size, m_classes,
+        m_transitions, m_needle_of, m_dict_link, newline_bits.buffer(), match_bits.buffer(), chunk_lines.buffer(),
+        chunk_hits.buffer()
+    )};
+    std::vector<cl::Event> sums{
+        prefix_sum(chunk_lines, line_base, num_chunks, scan), prefix_sum(chunk_hits, hit_offset, num_chunks, scan)};
+
+    // The number of hits sizes the output, this is the only point where the host waits before the end
+    cl_uint num_hits = 0;
+    queue.enqueueReadBuffer(hit_offset, CL_TRUE, counts_size, sizeof(cl_uint), &num_hits, &sums);
+    if (num_hits == 0) return {};
+
+    auto hit_lines = m_ctx.pool().acquire(num_hits * sizeof(cl_uint));
+    auto hit_positions = m_ctx.pool().acquire(num_hits * sizeof(cl_uint));
+    const std::vector<cl::Event> collect{launch_kernel(
+        queue, m_collect, sums, cl::NDRange{num_chunks}, haystack_size, m_chunk_size, newline_bits.buffer(),
+        match_bits.buffer(), line_base.buffer(), hit_offset.buffer(), hit_lines.buffer(), hit_positions.buffer()
+    )};
+
+    std::vector<cl_uint> lines(num_hits), positions(num_hits);
+    std::vector<cl::Event> reads(2);
+    queue.enqueueReadBuffer(hit_lines, CL_FALSE, 0, num_hits * sizeof(cl_uint), lines.data(), &collect, &reads[0]);
+    queue.enqueueReadBuffer(
+        hit_positions, CL_FALSE, 0, num_hits * sizeof(cl_uint), positions.data(), &collect, &reads[1]
+    );
+    cl::Event::waitForEvents(reads);
+
+    // Hits are ordered by position, so a line marked by two chunks shows up as two neighbours
+    std::vector<line_hit> hits;
+    for (cl_uint i = 0; i < num_hits; ++i) {
+      if (hits.empty() || hits.back().line != lines[i]) hits.push_back({lines[i], positions[i]});
+    }
+
+    return hits;
+  }
+
+  std::size_t footprint() const { return m_automaton.footprint(); }
+};
+
+} // namespace matching
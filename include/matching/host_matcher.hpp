@@ -0,0 +1,69 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "common/thread_pool.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+namespace matching {
+
+// Adds every counter vector of `parts` into `total`, splitting the needles between pool threads
+inline void merge_counts(
+    std::vector<unsigned> &total, const std::vector<std::vector<unsigned>> &parts,
+    clutils::thread_pool &pool = clutils::default_thread_pool()
+) {
+  constexpr std::size_t grain = 1 << 14;
+  pool.parallel_for(0, total.size(), grain, [&](std::size_t first, std::size_t last) {
+    for (const auto &part : parts) {
+      std::transform(
+          total.begin() + first, total.begin() + last, part.begin() + first, total.begin() + first, std::plus{}
+      );
+    }
+  });
+}
+
+// Multi-threaded host scan with any automaton that has count() and max_needle_length(). The haystack is cut into
+// chunks extended by max_len - 1 bytes; matches lying entirely inside such an extension are seen by two chunks, so
+// they are counted again and subtracted.
+template <typename Automaton>
+std::vector<unsigned> parallel_count(
+    const Automaton &dfa, std::string_view haystack, clutils::thread_pool &pool = clutils::default_thread_pool()
+) {
+  constexpr std::size_t min_chunk_size = 1 << 20;
+  const auto overlap = dfa.max_needle_length() - 1;
+  const auto chunk_size = std::max(min_chunk_size, haystack.size() / (4 * pool.size()) + 1);
+  const auto num_chunks = (haystack.size() + chunk_size - 1) / chunk_size;
+  if (num_chunks <= 1) return dfa.count(haystack);
+
+  std::vector<std::vector<unsigned>> parts(num_chunks);
+  pool.parallel_for(0, num_chunks, 1, [&](std::size_t first, std::size_t last) {
+    for (auto i = first; i < last; ++i) {
+      const auto start = i * chunk_size;
+      parts[i] = dfa.count(haystack.substr(start, chunk_size + overlap));
+      if (start + chunk_size >= haystack.size()) continue;
+
+      // Unsigned counters may wrap here, merging the chunks brings them back
+      const auto duplicates = dfa.count(haystack.substr(start + chunk_size, overlap));
+      std::transform(parts[i].begin(), parts[i].end(), duplicates.begin(), parts[i].begin(), std::minus{});
+    }
+  });
+
+  std::vector<unsigned> total(parts.front().size(), 0);
+  merge_counts(total, parts, pool);
+  return total;
+}
+
+} // namespace matching
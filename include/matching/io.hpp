@@ -0,0 +1,76 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace matching {
+
+// Dictionary files contain one needle per line, empty lines are skipped
+inline std::vector<std::string> read_dictionary(std::istream &is) {
+  std::vector<std::string> needles;
+
+  for (std::string line; std::getline(is, line);) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (!line.empty()) needles.push_back(std::move(line));
+  }
+
+  return needles;
+}
+
+inline std::vector<std::string> read_dictionary(const std::string &path) {
+  std::ifstream is{path};
+  if (!is) throw std::runtime_error{"Can't open dictionary file " + path};
+  return read_dictionary(is);
+}
+
+// Haystacks can be read into any contiguous container of chars, e.g. a pinned_buffer
+template <typename Container = std::string> Container read_haystack(std::istream &is, Container haystack = {}) {
+  constexpr std::size_t block_size = 1 << 20;
+  std::size_t size = 0;
+
+  while (is) {
+    haystack.resize(size + block_size);
+    is.read(haystack.data() + size, block_size);
+    size += is.gcount();
+  }
+
+  haystack.resize(size);
+  return haystack;
+}
+
+// Regular files are read in one go. Pipes, /dev/stdin and process substitutions have no size and are read in blocks.
+template <typename Container = std::string>
+Container read_haystack(const std::string &path, Container haystack = {}) {
+  std::ifstream is{path, std::ios::binary};
+  if (!is) throw std::runtime_error{"Can't open input file " + path};
+
+  const auto end = (is.seekg(0, std::ios::end) ? is.tellg() : std::streampos{-1});
+  if (end == std::streampos{-1}) {
+    is.clear();
+    return read_haystack(is, std::move(haystack));
+  }
+
+  const auto size = static_cast<std::size_t>(end);
+  is.seekg(0);
+  haystack.resize(size);
+  if (!is.read(haystack.data(), size)) throw std::runtime_error{"Can't read input file " + path};
+
+  return haystack;
+}
+
+} // namespace matching
@@ -0,0 +1,206 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "aho_corasick.hpp"
+#include "alphabet.hpp"
+#include "pattern.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace matching {
+
+// Flattened tables of the hot part of a lazy DFA, laid out like the Aho-Corasick automaton with output chains.
+// Transitions that leave the snapshot are `miss`; `subsets` keeps the pattern positions of every snapshot state so
+// that the host can continue from it.
+struct dfa_snapshot {
+  using state_type = automaton::state_type;
+  static constexpr state_type miss = std::numeric_limits<state_type>::max();
+
+  byte_classes classes = byte_classes::identity();
+  std::vector<state_type> transitions, needle_of, dict_link;
+  std::vector<std::vector<state_type>> subsets;
+
+  std::size_t num_states() const { return subsets.size(); }
+  std::size_t footprint() const {
+    return (transitions.size() + needle_of.size() + dict_link.size()) * sizeof(state_type) +
+           byte_classes::max_classes;
+  }
+};
+
+struct lazy_dfa_stats {
+  std::size_t cached_states, computed_transitions, flushes;
+};
+
+inline std::ostream &operator<<(std::ostream &os, const lazy_dfa_stats &stats) {
+  return os << stats.cached_states << " cached states, " << stats.computed_transitions << " transitions computed, "
+            << stats.flushes << " cache flushes";
+}
+
+// Pattern DFA determinized on demand, for pattern sets whose complete DFA is too large to build. States are sets of
+// pattern positions (see detail::pattern_positions) and are created when a transition is first taken. At most
+// `cache_states` of them are kept; once the cache is full it is dropped as a whole and refilled from the state being
+// left. Every state counts how often it is entered, and `snapshot` turns the most visited ones into tables that the
+// device runs. Not thread-safe.
+class lazy_dfa {
+public:
+  using state_type = automaton::state_type;
+  static constexpr state_type start = 0;
+  static constexpr std::size_t default_cache_states = std::size_t{1} << 16;
+
+private:
+  static constexpr state_type unknown = std::numeric_limits<state_type>::max();
+
+  detail::pattern_positions m_positions;
+  std::size_t m_cache_states;
+
+  std::map<std::vector<state_type>, state_type> m_state_of;
+  std::vector<const std::vector<state_type> *> m_subsets;
+  std::vector<state_type> m_transitions; // num_states x num_classes, unknown until taken
+  std::vector<std::vector<state_type>> m_accepts;
+  std::vector<std::uint64_t> m_visits;
+
+  std::size_t m_computed = 0, m_flushes = 0;
+
+  void flush() {
+    m_state_of.clear();
+    m_subsets.clear();
+    m_transitions.clear();
+    m_accepts.clear();
+    m_visits.clear();
+    ++m_flushes;
+    intern({});
+  }
+
+  state_type intern(std::vector<state_type> subset) {
+    if (const auto found = m_state_of.find(subset); found != m_state_of.end()) return found->second;
+    if (m_subsets.size() >= m_cache_states) flush();
+
+    const auto state = static_cast<state_type>(m_subsets.size());
+    const auto inserted = m_state_of.emplace(std::move(subset), state).first;
+    m_subsets.push_back(&inserted->first);
+    m_transitions.resize(m_transitions.size() + num_classes(), unknown);
+    m_accepts.push_back(m_positions.accepts(inserted->first));
+    m_visits.push_back(0);
+    return state;
+  }
+
+  // A flush while the successor is interned drops `state` too, so the transition is only recorded without one
+  state_type compute(state_type state, unsigned c) {
+    ++m_computed;
+    const auto flushes = m_flushes;
+    const auto next = intern(m_positions.successor(*m_subsets[state], c));
+    if (flushes == m_flushes) m_transitions[state * num_classes() + c] = next;
+    return next;
+  }
+
+public:
+  lazy_dfa(
+      const std::vector<std::string> &patterns, const byte_classes &classes = byte_classes::identity(),
+      std::size_t cache_states = default_cache_states
+  )
+      : m_positions{patterns, classes}, m_cache_states{cache_states} {
+    if (patterns.empty()) throw std::invalid_argument{"Dictionary is empty"};
+    if (cache_states < 2) throw std::invalid_argument{"Lazy DFA cache needs at least two states"};
+    intern({});
+  }
+
+  state_type next(state_type state, char symbol) {
+    const auto c = m_positions.classes(symbol);
+    const auto cached = m_transitions[state * num_classes() + c];
+    const auto next = (cached != unknown ? cached : compute(state, c));
+    ++m_visits[next];
+    return next;
+  }
+
+  // State of the cache for a set of positions taken from a snapshot
+  state_type resume(const std::vector<state_type> &subset) { return intern(subset); }
+
+  // Runs over `bytes` from `state` and adds the patterns ending at offsets from `count_from` on. Returns the state
+  // after the last byte.
+  template <typename T>
+  state_type scan(std::string_view bytes, state_type state, std::vector<T> &counts, std::size_t count_from = 0) {
+    for (std::size_t i = 0; i < bytes.size(); ++i) {
+      state = next(state, bytes[i]);
+      if (i < count_from) continue;
+      for (const auto pattern : m_accepts[state]) {
+        ++counts[pattern];
+      }
+    }
+    return state;
+  }
+
+  std::vector<unsigned> count(std::string_view haystack) {
+    std::vector<unsigned> counts(num_needles(), 0);
+    scan(haystack, start, counts);
+    return counts;
+  }
+
+  // Tables of the `max_states` most visited cached states, the start state always among them. Visit counts are halved
+  // afterwards so that the next snapshot follows the recent haystacks.
+  dfa_snapshot snapshot(std::size_t max_states) {
+    const auto nc = num_classes();
+    std::vector<state_type> order(m_subsets.size());
+    std::iota(order.begin(), order.end(), state_type{0});
+    std::stable_sort(order.begin() + 1, order.end(), [&](auto lhs, auto rhs) {
+      return m_visits[lhs] > m_visits[rhs];
+    });
+    order.resize(std::min(order.size(), std::max<std::size_t>(max_states, 1)));
+
+    std::vector<state_type> device_of(m_subsets.size(), dfa_snapshot::miss);
+    for (std::size_t i = 0; i < order.size(); ++i) {
+      device_of[order[i]] = static_cast<state_type>(i);
+    }
+
+    dfa_snapshot snapshot;
+    snapshot.classes = m_positions.classes;
+    snapshot.transitions.reserve(order.size() * nc);
+    snapshot.needle_of.assign(order.size(), automaton::no_needle);
+    snapshot.dict_link.assign(order.size(), automaton::root);
+
+    for (const auto state : order) {
+      for (unsigned c = 0; c < nc; ++c) {
+        const auto next = m_transitions[state * nc + c];
+        snapshot.transitions.push_back(next != unknown ? device_of[next] : dfa_snapshot::miss);
+      }
+      snapshot.subsets.push_back(*m_subsets[state]);
+    }
+
+    detail::output_chains chains{snapshot.transitions, snapshot.needle_of, snapshot.dict_link, nc};
+    for (std::size_t i = 0; i < order.size(); ++i) {
+      chains.set_outputs(static_cast<state_type>(i), m_accepts[order[i]]);
+    }
+
+    for (auto &visits : m_visits) {
+      visits /= 2;
+    }
+    return snapshot;
+  }
+
+  const byte_classes &classes() const { return m_positions.classes; }
+  std::size_t num_classes() const { return m_positions.classes.size(); }
+  std::size_t num_needles() const { return m_positions.num_patterns; }
+  std::size_t max_needle_length() const { return m_positions.max_length; }
+  std::size_t num_states() const { return m_subsets.size(); }
+  lazy_dfa_stats stats() const { return {m_subsets.size(), m_computed, m_flushes}; }
+};
+
+} // namespace matching
@@ -0,0 +1,153 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "device.hpp"
+#include "engine.hpp"
+#include "lazy_dfa.hpp"
+
+#include "kernelhpp/lazy_dfa_kernel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace matching {
+
+struct lazy_engine_stats {
+  std::size_t snapshots, snapshot_states, misses, host_bytes;
+  lazy_dfa_stats cache;
+};
+
+inline std::ostream &operator<<(std::ostream &os, const lazy_engine_stats &stats) {
+  return os << stats.snapshots << " snapshots of up to " << stats.snapshot_states << " states, " << stats.misses
+            << " chunks finished on the host (" << stats.host_bytes << " bytes), " << stats.cache;
+}
+
+// Chunked scan over a lazily determinized pattern DFA. The device runs a snapshot of the hot states; a chunk that
+// reaches a state outside of it is finished on the host by the lazy DFA, which materializes the missing states. When
+// the host had to scan more than 1/16 of a haystack the snapshot is retaken before the next one. The first haystack
+// warms the cache up on its first MiB.
+class lazy_dfa_engine : public engine {
+  static constexpr std::size_t warmup_size = 1 << 20;
+  static constexpr std::size_t resnapshot_ratio = 16;
+
+  const device_context &m_ctx;
+  lazy_dfa m_dfa;
+  unsigned m_chunk_size;
+  std::size_t m_snapshot_states;
+
+  cl::Program m_program;
+  cl::Kernel m_kernel;
+  device_array m_classes;
+
+  struct device_snapshot {
+    device_array transitions, needle_of, dict_link;
+  };
+  dfa_snapshot m_snapshot;
+  std::optional<device_snapshot> m_device;
+  lazy_dfa_stats m_snapshot_cache{}; // Cache statistics when the snapshot was taken
+  lazy_engine_stats m_stats{};
+
+  void take_snapshot() {
+    m_snapshot = m_dfa.snapshot(m_snapshot_states);
+    m_device.emplace(device_snapshot{
+        {m_ctx, m_snapshot.transitions}, {m_ctx, m_snapshot.needle_of}, {m_ctx, m_snapshot.dict_link}});
+    m_snapshot_cache = m_dfa.stats();
+    ++m_stats.snapshots;
+  }
+
+public:
+  // `cache_states` bounds the host cache, and snapshots are also kept within the largest device allocation
+  lazy_dfa_engine(
+      const device_context &ctx, const std::vector<std::string> &patterns,
+      const byte_classes &classes = byte_classes::identity(), unsigned chunk_size = default_chunk_size,
+      std::size_t cache_states = lazy_dfa::default_cache_states
+  )
+      : m_ctx{ctx}, m_dfa{patterns, classes, cache_states}, m_chunk_size{chunk_size},
+        m_snapshot_states{std::min<std::size_t>(
+            cache_states,
+            m_ctx.device().getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>() / (m_dfa.num_classes() * sizeof(cl_uint))
+        )},
+        m_program{m_ctx.build_program(lazy_dfa_kernel::source(
+            m_dfa.num_classes(), static_cast<unsigned>(m_dfa.max_needle_length() - 1)
+        ))},
+        m_kernel{m_program, lazy_dfa_kernel::entry().c_str()}, m_classes{m_ctx, m_dfa.classes().table()} {
+    m_stats.snapshot_states = m_snapshot_states;
+  }
+
+  match_result match(std::string_view haystack) override {
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+    if (haystack.empty()) return {std::vector<unsigned>(m_dfa.num_needles(), 0), {}};
+    const auto num_chunks = (haystack.size() + m_chunk_size - 1) / m_chunk_size;
+    const auto haystack_size = haystack_length(haystack.size(), num_chunks, m_chunk_size);
+
+    if (!m_device) {
+      m_dfa.count(haystack.substr(0, warmup_size));
+      take_snapshot();
+    }
+
+    auto misses_buf = m_ctx.pool().acquire(2 * num_chunks * sizeof(cl_uint));
+
+    auto [counts, event] = count_matches(
+        m_ctx, haystack, m_dfa.num_needles(),
+        [&](const auto &deps, const auto &haystack_arg, const auto &counts_arg) {
+          return launch_kernel(
+              m_ctx.queue(), m_kernel, deps, cl::NDRange{num_chunks}, haystack_arg, haystack_size, m_chunk_size,
+              m_classes, m_device->transitions, m_device->needle_of, m_device->dict_link, counts_arg,
+              misses_buf.buffer()
+          );
+        }
+    );
+
+    std::vector<cl_uint> misses(2 * num_chunks);
+    m_ctx.queue().enqueueReadBuffer(misses_buf, CL_TRUE, 0, clutils::sizeof_container(misses), misses.data());
+
+    // Misses carry the position of the byte that left the snapshot and the snapshot state before it. Hits in the
+    // warm-up of a chunk are not counted.
+    std::size_t host_bytes = 0;
+    for (std::size_t chunk = 0; chunk < num_chunks; ++chunk) {
+      const auto position = misses[2 * chunk];
+      if (position == dfa_snapshot::miss) continue;
+
+      const auto chunk_start = chunk * m_chunk_size;
+      const auto chunk_end = std::min(chunk_start + m_chunk_size, haystack.size());
+      const auto state = m_dfa.resume(m_snapshot.subsets[misses[2 * chunk + 1]]);
+      const auto count_from = (chunk_start > position ? chunk_start - position : 0);
+      m_dfa.scan(haystack.substr(position, chunk_end - position), state, counts, count_from);
+
+      host_bytes += chunk_end - position;
+      ++m_stats.misses;
+    }
+    m_stats.host_bytes += host_bytes;
+
+    const auto cache = m_dfa.stats();
+    const bool changed = cache.computed_transitions != m_snapshot_cache.computed_transitions;
+    if (changed && host_bytes * resnapshot_ratio > haystack.size()) take_snapshot();
+
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+    return {std::move(counts), {to_millis(event_duration(event)), to_millis(wall_end - wall_start)}};
+  }
+
+  std::string name() const override { return "lazy-dfa"; }
+  std::size_t footprint() const override { return m_snapshot.footprint(); }
+  lazy_engine_stats stats() const {
+    auto stats = m_stats;
+    stats.cache = m_dfa.stats();
+    return stats;
+  }
+};
+
+} // namespace matching
@@ -0,0 +1,102 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "alphabet.hpp"
+#include "compressed_automaton.hpp"
+#include "device.hpp"
+#include "engine.hpp"
+#include "engines.hpp"
+#include "host_matcher.hpp"
+
+#include "common/partition.hpp"
+#include "common/thread_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace matching {
+
+// Runs a replica of another engine on every NUMA node of a CPU device. Each node is a sub-device with its own context,
+// so its copy of the automaton and its haystack buffers are allocated and touched by that node only, and it scans one
+// contiguous shard of the haystack. Shards overlap by max_len - 1 bytes; matches lying entirely inside an overlap are
+// seen by two shards and are subtracted on the host, which costs a few bytes of scanning per shard.
+class numa_engine : public engine {
+  std::vector<std::unique_ptr<device_context>> m_nodes;
+  std::vector<std::unique_ptr<engine>> m_replicas;
+  compressed_automaton m_boundary;
+  std::size_t m_overlap;
+
+public:
+  numa_engine(
+      const device_context &ctx, std::string_view name, const std::vector<std::string> &needles,
+      const byte_classes &classes = byte_classes::identity(), unsigned chunk_size = default_chunk_size
+  )
+      : m_boundary{needles.begin(), needles.end(), classes}, m_overlap{m_boundary.max_needle_length() - 1} {
+    for (auto &device : clutils::partition_by_affinity_domain(ctx.device())) {
+      m_nodes.push_back(std::make_unique<device_context>(ctx.platform(), device, ctx.mode()));
+      m_replicas.push_back(make_engine(name, *m_nodes.back(), needles, classes, chunk_size));
+    }
+  }
+
+  match_result match(std::string_view haystack) override {
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+    const auto shard_size = (haystack.size() + m_replicas.size() - 1) / m_replicas.size();
+
+    auto &pool = clutils::default_thread_pool();
+    std::vector<std::future<match_result>> shards;
+    std::vector<unsigned> counts(m_boundary.num_needles(), 0);
+
+    for (std::size_t i = 0, start = 0; i < m_replicas.size() && start < haystack.size(); ++i, start += shard_size) {
+      const auto shard = haystack.substr(start, shard_size + m_overlap);
+      shards.push_back(pool.submit([this, i, shard] { return m_replicas[i]->match(shard); }));
+
+      const auto end = start + shard_size;
+      if (end >= haystack.size()) continue;
+
+      // Unsigned counters may wrap here, adding the shard counts below brings them back
+      const auto duplicates = m_boundary.count(haystack.substr(end, m_overlap));
+      std::transform(counts.begin(), counts.end(), duplicates.begin(), counts.begin(), std::minus{});
+    }
+
+    std::chrono::duration<double, std::milli> pure{0};
+    std::vector<std::vector<unsigned>> parts;
+    for (auto &shard : shards) {
+      auto result = pool.wait(shard);
+      pure = std::max(pure, result.time.pure);
+      parts.push_back(std::move(result.counts));
+    }
+    merge_counts(counts, parts, pool);
+
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+    return {counts, {pure, to_millis(wall_end - wall_start)}};
+  }
+
+  std::string name() const override { return "numa-" + m_replicas.front()->name(); }
+
+  std::size_t footprint() const override {
+    std::size_t total = 0;
+    for (const auto &replica : m_replicas) {
+      total += replica->footprint();
+    }
+    return total;
+  }
+
+  std::size_t num_nodes() const { return m_nodes.size(); }
+};
+
+} // namespace matching
@@ -0,0 +1,96 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "alphabet.hpp"
+
+#include "common/thread_pool.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace matching {
+
+// Codes of a haystack packed into 2 or 4 bits per symbol. Bytes are packed by their automaton class, so only the
+// classes that actually occur in the haystack need a code: a DNA haystack with a dictionary over ACGT packs into 2
+// bits even though the automaton also has a class for all other bytes. Symbol i is stored in byte i / (8 / bits) at
+// bit (i % (8 / bits)) * bits, which a little-endian device reads back from 32-bit words in the same order.
+struct packing {
+  static constexpr std::uint8_t no_code = 0xff;
+  static constexpr unsigned max_codes = 16;
+
+  unsigned bits = 0; // 2 or 4, 0 if the sample has too many classes
+  std::array<std::uint8_t, byte_classes::max_classes> code_of{}; // Byte to code or no_code
+  std::array<std::uint8_t, max_codes> class_of{};                // Code to automaton class
+
+  unsigned symbols_per_byte() const { return 8 / bits; }
+};
+
+// Codes for the classes that occur in `sample`. Bytes outside of them are left without a code, and a haystack that
+// holds any of them can't be packed.
+inline packing plan_packing(const byte_classes &classes, std::string_view sample) {
+  std::array<bool, byte_classes::max_classes> seen{};
+  for (const auto byte : sample) {
+    seen[classes(byte)] = true;
+  }
+
+  packing plan;
+  unsigned num_codes = 0;
+  std::array<std::uint8_t, byte_classes::max_classes> code_of_class;
+  code_of_class.fill(packing::no_code);
+  for (unsigned c = 0; c < classes.size(); ++c) {
+    if (!seen[c]) continue;
+    if (num_codes == packing::max_codes) return plan;
+    plan.class_of[num_codes] = static_cast<std::uint8_t>(c);
+    code_of_class[c] = static_cast<std::uint8_t>(num_codes++);
+  }
+
+  plan.bits = (num_codes <= 4 ? 2 : 4);
+  for (unsigned b = 0; b < byte_classes::max_classes; ++b) {
+    plan.code_of[b] = code_of_class[classes(static_cast<char>(b))];
+  }
+  return plan;
+}
+
+// Packs the haystack into `packed`, padded to whole 32-bit words, on the pool. Returns false when some byte has no
+// code, in which case the contents of `packed` are unspecified.
+template <typename Container>
+bool pack_haystack(
+    const packing &plan, std::string_view haystack, Container &packed,
+    clutils::thread_pool &pool = clutils::default_thread_pool()
+) {
+  constexpr std::size_t grain = 1 << 18;
+  const auto per_byte = plan.symbols_per_byte();
+  const auto num_bytes = (haystack.size() + per_byte - 1) / per_byte;
+  packed.resize((num_bytes + 3) / 4 * 4);
+
+  std::atomic<bool> valid{true};
+  pool.parallel_for(0, packed.size(), grain, [&](std::size_t first, std::size_t last) {
+    std::uint8_t missing = 0;
+    for (auto i = first; i < last; ++i) {
+      std::uint8_t byte = 0;
+      for (std::size_t k = 0, j = i * per_byte; k < per_byte && j < haystack.size(); ++k, ++j) {
+        const auto code = plan.code_of[static_cast<std::uint8_t>(haystack[j])];
+        missing |= (code == packing::no_code);
+        byte |= static_cast<std::uint8_t>(code << (k * plan.bits));
+      }
+      packed[i] = static_cast<typename Container::value_type>(byte);
+    }
+    if (missing) valid.store(false, std::memory_order_relaxed);
+  });
+
+  return valid.load();
+}
+
+} // namespace matching
@@ -0,0 +1,502 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "aho_corasick.hpp"
+#include "alphabet.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace matching {
+
+// One element of a pattern: a set of bytes repeated between min and max times
+struct pattern_element {
+  std::bitset<byte_classes::max_classes> bytes;
+  unsigned min = 1, max = 1;
+};
+
+inline constexpr unsigned max_pattern_repeat = 1024;
+inline constexpr std::size_t default_max_dfa_states = std::size_t{1} << 20;
+
+namespace detail {
+
+inline std::invalid_argument pattern_error(std::string_view pattern, std::size_t offset, const std::string &what) {
+  return std::invalid_argument{
+      "Pattern \"" + std::string{pattern} + "\": " + what + " at offset " + std::to_string(offset)};
+}
+
+inline unsigned hex_digit(std::string_view pattern, std::size_t offset) {
+  if (offset >= pattern.size()) throw pattern_error(pattern, offset, "incomplete \\x escape");
+  const char c = pattern[offset];
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  throw pattern_error(pattern, offset, "invalid hex digit");
+}
+
+// Byte after a backslash at `i`, which is advanced past the escape
+inline unsigned char parse_escape(std::string_view pattern, std::size_t &i) {
+  if (++i >= pattern.size()) throw pattern_error(pattern, i, "trailing backslash");
+
+  switch (pattern[i]) {
+  case 'n': return '\n';
+  case 'r': return '\r';
+  case 't': return '\t';
+  case '0': return '\0';
+  case 'x': {
+    const auto value = hex_digit(pattern, i + 1) * 16 + hex_digit(pattern, i + 2);
+    i += 2;
+    return static_cast<unsigned char>(value);
+  }
+  default: return static_cast<unsigned char>(pattern[i]);
+  }
+}
+
+inline unsigned parse_number(std::string_view pattern, std::size_t &i) {
+  const auto start = i;
+  unsigned value = 0;
+  for (; i < pattern.size() && pattern[i] >= '0' && pattern[i] <= '9'; ++i) {
+    value = value * 10 + (pattern[i] - '0');
+    if (value > max_pattern_repeat) {
+      throw pattern_error(pattern, start, "repeat count above " + std::to_string(max_pattern_repeat));
+    }
+  }
+  if (i == start) throw pattern_error(pattern, i, "expected a repeat count");
+  return value;
+}
+
+} // namespace detail
+
+// Pattern syntax: `?` matches any byte, `[...]` a byte set with ranges (`[0-9a-f]`, negated with `[^...]`), `{n}` and
+// `{n,m}` repeat the preceding element, `\` escapes the next byte and also knows `\n`, `\r`, `\t`, `\0` and `\xHH`.
+// Every other byte matches itself. Unbounded repeats are not supported, so every pattern has a longest match.
+inline std::vector<pattern_element> parse_pattern(std::string_view pattern) {
+  std::vector<pattern_element> elements;
+  bool repeated = false;
+
+  for (std::size_t i = 0; i < pattern.size(); ++i) {
+    const char c = pattern[i];
+
+    if (c == '{') {
+      if (elements.empty() || repeated) throw detail::pattern_error(pattern, i, "repeat without an element");
+      ++i;
+      auto &element = elements.back();
+      element.min = element.max = detail::parse_number(pattern, i);
+      if (i < pattern.size() && pattern[i] == ',') {
+        ++i;
+        element.max = detail::parse_number(pattern, i);
+      }
+      if (i >= pattern.size() || pattern[i] != '}') throw detail::pattern_error(pattern, i, "expected '}'");
+      if (element.min > element.max) throw detail::pattern_error(pattern, i, "repeat minimum above maximum");
+      repeated = true;
+      continue;
+    }
+
+    if (c == '*' || c == '+') {
+      throw detail::pattern_error(pattern, i, "unbounded repeats are not supported, use {n,m}");
+    }
+
+    pattern_element element;
+    if (c == '?') {
+      element.bytes.set();
+    } else if (c == '\\') {
+      element.bytes.set(detail::parse_escape(pattern, i));
+    } else if (c == '[') {
+      const auto start = i++;
+      const bool negate = (i < pattern.size() && pattern[i] == '^');
+      if (negate) ++i;
+
+      for (bool first = true; i < pattern.size() && (first || pattern[i] != ']'); ++i, first = false) {
+        auto low = static_cast<unsigned char>(pattern[i]);
+        if (pattern[i] == '\\') low = detail::parse_escape(pattern, i);
+
+        auto high = low;
+        if (i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+          i += 2;
+          high = static_cast<unsigned char>(pattern[i]);
+          if (pattern[i] == '\\') high = detail::parse_escape(pattern, i);
+          if (high < low) throw detail::pattern_error(pattern, i, "reversed range");
+        }
+
+        for (unsigned b = low; b <= high; ++b) {
+          element.bytes.set(b);
+        }
+      }
+
+      if (i >= pattern.size()) throw detail::pattern_error(pattern, start, "unterminated byte set");
+      if (negate) element.bytes.flip();
+      if (element.bytes.none()) throw detail::pattern_error(pattern, start, "empty byte set");
+    } else {
+      element.bytes.set(static_cast<unsigned char>(c));
+    }
+
+    elements.push_back(element);
+    repeated = false;
+  }
+
+  std::erase_if(elements, [](const auto &element) { return element.max == 0; });
+  const bool empty_match = std::all_of(elements.begin(), elements.end(), [](const auto &e) { return e.min == 0; });
+  if (empty_match) throw detail::pattern_error(pattern, 0, "pattern matches the empty string");
+
+  return elements;
+}
+
+namespace detail {
+
+// Patterns expanded into positions of one numbering: position k of a pattern stands for "the first k elements are
+// matched" and the last one of each pattern accepts it. An element repeated {n,m} becomes n required and m - n
+// optional positions, and bytes that no pattern tells apart share a class. Sets of positions are the states of the
+// pattern DFA; the start positions of all patterns are implied in every set and never stored.
+struct pattern_positions {
+  using state_type = automaton::state_type;
+  using byte_set = std::bitset<byte_classes::max_classes>;
+  static constexpr auto none = automaton::no_needle;
+
+  std::vector<state_type> set_of;     // Byte set index of the element at a position, none for accepting positions
+  std::vector<std::uint8_t> optional; // The element may be skipped
+  std::vector<state_type> pattern_of; // Pattern accepted at an accepting position, none elsewhere
+  std::vector<std::vector<unsigned>> classes_of_set;
+  std::vector<std::vector<bool>> set_has_class;
+  std::vector<std::vector<state_type>> from_start; // Successors of the start positions on every class
+  std::vector<bool> in_start;
+  byte_classes classes = byte_classes::identity();
+  std::size_t num_patterns = 0, max_length = 0;
+
+  // Classes of `widen_to` (e.g. case-insensitive letters) widen every byte set to whole classes
+  pattern_positions(const std::vector<std::string> &patterns, const byte_classes &widen_to) {
+    std::vector<state_type> starts;
+    std::vector<byte_set> sets;
+    std::map<std::string, state_type> set_index;
+
+    std::array<byte_set, byte_classes::max_classes> class_members;
+    for (unsigned b = 0; b < byte_classes::max_classes; ++b) {
+      class_members[widen_to(static_cast<char>(b))].set(b);
+    }
+
+    for (state_type p = 0; p < patterns.size(); ++p) {
+      starts.push_back(static_cast<state_type>(set_of.size()));
+      std::size_t length = 0;
+
+      for (auto element : parse_pattern(patterns[p])) {
+        byte_set widened;
+        for (unsigned b = 0; b < byte_classes::max_classes; ++b) {
+          if (element.bytes[b]) widened |= class_members[widen_to(static_cast<char>(b))];
+        }
+
+        const auto [found, inserted] =
+            set_index.try_emplace(widened.to_string(), static_cast<state_type>(sets.size()));
+        if (inserted) sets.push_back(widened);
+
+        for (unsigned r = 0; r < element.max; ++r) {
+          set_of.push_back(found->second);
+          optional.push_back(r >= element.min);
+          pattern_of.push_back(none);
+        }
+        length += element.max;
+      }
+
+      set_of.push_back(none);
+      optional.push_back(false);
+      pattern_of.push_back(p);
+      max_length = std::max(max_length, length);
+    }
+    num_patterns = patterns.size();
+
+    // Bytes belonging to the same sets share a class
+    byte_classes::table_type table{};
+    std::map<std::vector<bool>, unsigned> signature_class;
+    for (unsigned b = 0; b < byte_classes::max_classes; ++b) {
+      std::vector<bool> signature(sets.size());
+      for (std::size_t s = 0; s < sets.size(); ++s) {
+        signature[s] = sets[s][b];
+      }
+      const auto [found, inserted] =
+          signature_class.try_emplace(std::move(signature), static_cast<unsigned>(signature_class.size()));
+      table[b] = static_cast<std::uint8_t>(found->second);
+    }
+    classes = byte_classes::from_table(table);
+
+    classes_of_set.resize(sets.size());
+    set_has_class.assign(sets.size(), std::vector<bool>(classes.size(), false));
+    for (std::size_t s = 0; s < sets.size(); ++s) {
+      for (unsigned b = 0; b < byte_classes::max_classes; ++b) {
+        const auto c = classes(static_cast<char>(b));
+        if (sets[s][b] && !set_has_class[s][c]) {
+          set_has_class[s][c] = true;
+          classes_of_set[s].push_back(c);
+        }
+      }
+    }
+
+    std::vector<state_type> start_closure;
+    for (const auto start : starts) {
+      add_closure(start, start_closure);
+    }
+
+    from_start.resize(classes.size());
+    for (const auto position : start_closure) {
+      if (set_of[position] == none) continue;
+      for (const auto c : classes_of_set[set_of[position]]) {
+        add_closure(position + 1, from_start[c]);
+      }
+    }
+
+    in_start.assign(set_of.size(), false);
+    for (const auto position : start_closure) {
+      in_start[position] = true;
+    }
+  }
+
+  // Optional elements are skipped by epsilon moves to the next position
+  void add_closure(state_type position, std::vector<state_type> &out) const {
+    out.push_back(position);
+    while (optional[position]) {
+      out.push_back(++position);
+    }
+  }
+
+  // Brings a set of positions into its canonical form: sorted, unique and without the implied start positions
+  void normalize(std::vector<state_type> &positions) const {
+    std::erase_if(positions, [&](auto position) { return in_start[position]; });
+    std::sort(positions.begin(), positions.end());
+    positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+  }
+
+  // Successors of `positions` on every class at once, not normalized
+  void successors(const std::vector<state_type> &positions, std::vector<std::vector<state_type>> &next) const {
+    next.resize(classes.size());
+    for (unsigned c = 0; c < classes.size(); ++c) {
+      next[c] = from_start[c];
+    }
+
+    for (const auto position : positions) {
+      if (set_of[position] == none) continue;
+      for (const auto c : classes_of_set[set_of[position]]) {
+        add_closure(position + 1, next[c]);
+      }
+    }
+  }
+
+  // Successor of `positions` on a single class, normalized
+  std::vector<state_type> successor(const std::vector<state_type> &positions, unsigned c) const {
+    auto next = from_start[c];
+    for (const auto position : positions) {
+      if (set_of[position] != none && set_has_class[set_of[position]][c]) add_closure(position + 1, next);
+    }
+    normalize(next);
+    return next;
+  }
+
+  // Patterns accepted by a set of positions, sorted
+  std::vector<state_type> accepts(const std::vector<state_type> &positions) const {
+    std::vector<state_type> patterns;
+    for (const auto position : positions) {
+      if (pattern_of[position] != none) patterns.push_back(pattern_of[position]);
+    }
+    std::sort(patterns.begin(), patterns.end());
+    return patterns;
+  }
+};
+
+// Reports the patterns accepted by a state of a flattened DFA: the state reports the first one itself and links to a
+// chain of extra output-only states for the rest, which kernels follow like dictionary links. Chains with the same
+// patterns are shared.
+class output_chains {
+  using state_type = automaton::state_type;
+
+  std::vector<state_type> &m_transitions, &m_needle_of, &m_dict_link;
+  std::size_t m_num_classes;
+  std::map<std::vector<state_type>, state_type> m_chain_of;
+
+  state_type chain(std::vector<state_type> outputs) {
+    if (outputs.empty()) return automaton::root;
+    if (const auto found = m_chain_of.find(outputs); found != m_chain_of.end()) return found->second;
+
+    const auto link = chain(std::vector<state_type>(outputs.begin() + 1, outputs.end()));
+    const auto state = static_cast<state_type>(m_needle_of.size());
+    m_needle_of.push_back(outputs.front());
+    m_dict_link.push_back(link);
+    m_transitions.resize(m_transitions.size() + m_num_classes, automaton::root);
+    m_chain_of.emplace(std::move(outputs), state);
+    return state;
+  }
+
+public:
+  output_chains(
+      std::vector<state_type> &transitions, std::vector<state_type> &needle_of, std::vector<state_type> &dict_link,
+      std::size_t num_classes
+  )
+      : m_transitions{transitions}, m_needle_of{needle_of}, m_dict_link{dict_link}, m_num_classes{num_classes} {}
+
+  void set_outputs(state_type state, const std::vector<state_type> &outputs) {
+    if (outputs.empty()) return;
+    m_needle_of[state] = outputs.front();
+    m_dict_link[state] = chain(std::vector<state_type>(outputs.begin() + 1, outputs.end()));
+  }
+};
+
+} // namespace detail
+
+// Compiles patterns into one search DFA with the flattened layout of the Aho-Corasick automaton, so that the same
+// kernels run it. The subset construction runs over the pattern positions and classes, and the DFA is then minimized
+// by partition refinement. A state that accepts several patterns reports them through a chain of extra output-only
+// states. Counts are the number of positions where a match of the pattern ends.
+//
+// Classes of `classes` (e.g. case-insensitive letters) widen every byte set to whole classes. The subset construction
+// stops with an error once it exceeds `max_states` states.
+inline automaton compile_patterns(
+    const std::vector<std::string> &patterns, const byte_classes &classes = byte_classes::identity(),
+    std::size_t max_states = default_max_dfa_states, build_report *report = nullptr
+) {
+  using state_type = automaton::state_type;
+  using clock = std::chrono::steady_clock;
+  constexpr auto none = automaton::no_needle;
+
+  if (patterns.empty()) throw std::invalid_argument{"Dictionary is empty"};
+
+  auto phase_start = clock::now();
+  const auto end_phase = [&](const char *name, std::size_t peak_bytes) {
+    const auto now = clock::now();
+    if (report) {
+      report->phases.push_back(
+          {name, std::chrono::duration_cast<std::chrono::milliseconds>(now - phase_start), peak_bytes}
+      );
+    }
+    phase_start = now;
+  };
+
+  const detail::pattern_positions positions{patterns, classes};
+  const auto num_classes = positions.classes.size();
+
+  std::map<std::vector<state_type>, state_type> state_of;
+  std::vector<const std::vector<state_type> *> subsets;
+  std::vector<state_type> dfa; // num_states x num_classes
+  std::size_t subset_bytes = 0;
+
+  const auto intern = [&](std::vector<state_type> &subset) {
+    positions.normalize(subset);
+
+    const auto [found, inserted] = state_of.try_emplace(std::move(subset), static_cast<state_type>(subsets.size()));
+    if (inserted) {
+      if (subsets.size() >= max_states) {
+        throw std::runtime_error{
+            "Patterns need more than " + std::to_string(max_states) +
+            " DFA states, use fewer or narrower wildcards and repeats or raise the state limit"};
+      }
+      subsets.push_back(&found->first);
+      subset_bytes += found->first.size() * sizeof(state_type);
+    }
+    return found->second;
+  };
+
+  std::vector<state_type> empty;
+  intern(empty);
+
+  std::vector<std::vector<state_type>> next;
+  for (std::size_t state = 0; state < subsets.size(); ++state) {
+    positions.successors(*subsets[state], next);
+    for (unsigned c = 0; c < num_classes; ++c) {
+      dfa.push_back(intern(next[c]));
+    }
+  }
+
+  const auto num_dfa_states = subsets.size();
+  std::vector<std::vector<state_type>> accepts(num_dfa_states);
+  for (std::size_t state = 0; state < num_dfa_states; ++state) {
+    accepts[state] = positions.accepts(*subsets[state]);
+  }
+
+  end_phase("subset construction", subset_bytes + dfa.size() * sizeof(state_type));
+  state_of = {};
+  subsets = {};
+
+  // Moore's partition refinement: states start grouped by their accepted patterns and are split by the blocks of
+  // their successors until the number of blocks stops growing
+  std::vector<state_type> block(num_dfa_states);
+  std::size_t num_blocks = 0;
+  {
+    std::map<std::vector<state_type>, state_type> block_of;
+    for (std::size_t state = 0; state < num_dfa_states; ++state) {
+      block[state] = block_of.try_emplace(accepts[state], static_cast<state_type>(block_of.size())).first->second;
+    }
+    num_blocks = block_of.size();
+  }
+
+  std::vector<state_type> order(num_dfa_states), refined(num_dfa_states);
+  const auto signature_less = [&](state_type lhs, state_type rhs) {
+    if (block[lhs] != block[rhs]) return block[lhs] < block[rhs];
+    for (unsigned c = 0; c < num_classes; ++c) {
+      const auto l = block[dfa[lhs * num_classes + c]], r = block[dfa[rhs * num_classes + c]];
+      if (l != r) return l < r;
+    }
+    return false;
+  };
+
+  for (;;) {
+    std::iota(order.begin(), order.end(), state_type{0});
+    std::sort(order.begin(), order.end(), signature_less);
+
+    state_type next_block = 0;
+    for (std::size_t i = 0; i < order.size(); ++i) {
+      if (i && signature_less(order[i - 1], order[i])) ++next_block;
+      refined[order[i]] = next_block;
+    }
+
+    const auto refined_blocks = std::size_t{next_block} + 1;
+    block.swap(refined);
+    if (refined_blocks == num_blocks) break;
+    num_blocks = refined_blocks;
+  }
+
+  end_phase("minimization", (order.size() + refined.size() + block.size()) * sizeof(state_type));
+
+  // The start state becomes the root. Blocks are renumbered so that it gets 0.
+  std::vector<state_type> renumber(num_blocks);
+  std::iota(renumber.begin(), renumber.end(), state_type{0});
+  std::swap(renumber[0], renumber[block[0]]);
+
+  std::vector<state_type> transitions(num_blocks * num_classes, 0), needle_of(num_blocks, none),
+      dict_link(num_blocks, automaton::root);
+  std::vector<const std::vector<state_type> *> block_accepts(num_blocks, nullptr);
+  for (std::size_t state = 0; state < num_dfa_states; ++state) {
+    const auto b = renumber[block[state]];
+    if (block_accepts[b]) continue;
+    block_accepts[b] = &accepts[state];
+    for (unsigned c = 0; c < num_classes; ++c) {
+      transitions[b * num_classes + c] = renumber[block[dfa[state * num_classes + c]]];
+    }
+  }
+
+  detail::output_chains chains{transitions, needle_of, dict_link, num_classes};
+  for (std::size_t b = 0; b < num_blocks; ++b) {
+    chains.set_outputs(static_cast<state_type>(b), *block_accepts[b]);
+  }
+
+  end_phase("tables", (transitions.size() + needle_of.size() + dict_link.size()) * sizeof(state_type));
+
+  return automaton::from_tables(
+      positions.classes, std::move(transitions), std::move(needle_of), std::move(dict_link), patterns.size(),
+      positions.max_length
+  );
+}
+
+} // namespace matching
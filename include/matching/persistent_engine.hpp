@@ -0,0 +1,250 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "aho_corasick.hpp"
+#include "device.hpp"
+#include "engine.hpp"
+
+#include "common/svm_memory.hpp"
+#include "kernelhpp/persistent_ac_kernel.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace matching {
+
+inline bool supports_svm_atomics(const cl::Device &device) {
+  const auto caps = svm_capabilities(device);
+  return (caps & CL_DEVICE_SVM_FINE_GRAIN_BUFFER) && (caps & CL_DEVICE_SVM_ATOMICS);
+}
+
+// Aho-Corasick scan by a persistent kernel. The kernel is launched once with enough work-groups to fill the device;
+// the groups take descriptors of haystack spans from a ring buffer until the host sets the stop flag, so a stream of
+// small batches pays for a launch only once. The haystack is copied into one of two arena slots, each slot prefixed
+// with the max_len - 1 bytes preceding it for warm-up, and the host fills one slot while the device scans the other.
+// Groups finish spans in any order, so every slot counts its own completed spans and is refilled only once all spans
+// published into it are done.
+// Host and device talk through fine-grained SVM atomics. Devices without them fall back to draining the queue: all
+// descriptors are written before the launch and the kernel exits once they are done, one launch per batch.
+class persistent_engine : public engine {
+  enum control_slot { head, tail, completed, stop, slot_completed, num_slots = slot_completed + 2 };
+
+  static constexpr unsigned group_size = 64;
+  static constexpr unsigned groups_per_unit = 4;
+  static constexpr unsigned descriptors_per_slot = 64;
+
+  const device_context &m_ctx;
+  automaton m_automaton;
+  unsigned m_chunk_size;
+  bool m_persistent;
+
+  cl::Program m_program;
+  cl::Kernel m_kernel;
+  device_array m_classes, m_transitions, m_needle_of, m_dict_link;
+  std::size_t m_local_size, m_num_groups;
+
+  // Persistent mode only
+  cl::CommandQueue m_serve_queue;
+  clutils::svm_array<cl_uint> m_control, m_counts;
+  clutils::svm_array<cl_uint4> m_descriptors;
+  clutils::svm_array<char> m_arena;
+  cl::Event m_serving;
+  cl_uint m_published = 0;
+  std::array<cl_uint, 2> m_slot_published{}; // Spans ever published into each arena slot
+
+  // Drain mode only, reused between batches
+  std::vector<cl_uint4> m_spans;
+
+  static cl::Program build(const device_context &ctx, const automaton &dfa, bool persistent) {
+    if (!supports_opencl_c2(ctx.device())) throw std::runtime_error{"Persistent engine needs OpenCL C 2.0"};
+
+    const auto overlap = static_cast<unsigned>(dfa.max_needle_length() - 1);
+    return ctx.build_program(
+        persistent_ac_kernel::source(dfa.num_classes(), overlap, static_cast<unsigned>(persistent)), true
+    );
+  }
+
+  std::size_t overlap() const { return m_automaton.max_needle_length() - 1; }
+  std::size_t span_size() const { return m_local_size * m_chunk_size; }
+  std::size_t slot_payload() const { return span_size() * descriptors_per_slot; }
+  std::size_t slot_size() const { return overlap() + slot_payload(); }
+
+  std::atomic_ref<cl_uint> control(control_slot slot) const { return std::atomic_ref<cl_uint>{m_control[slot]}; }
+
+  void start_serving() {
+    const cl_svm_mem_flags shared = CL_MEM_SVM_FINE_GRAIN_BUFFER | CL_MEM_SVM_ATOMICS;
+    const cl_uint capacity = 2 * descriptors_per_slot;
+
+    m_control = clutils::svm_array<cl_uint>{m_ctx.context(), num_slots, shared};
+    m_counts = clutils::svm_array<cl_uint>{m_ctx.context(), m_automaton.num_needles(), shared};
+    m_descriptors = clutils::svm_array<cl_uint4>{m_ctx.context(), capacity};
+    m_arena = clutils::svm_array<char>{m_ctx.context(), 2 * slot_size()};
+
+    set_kernel_args(
+        m_kernel, static_cast<void *>(m_control.data()), static_cast<void *>(m_descriptors.data()), capacity,
+        static_cast<void *>(m_arena.data()), m_classes, m_transitions, m_needle_of, m_dict_link,
+        static_cast<void *>(m_counts.data())
+    );
+    m_serve_queue = cl::CommandQueue{m_ctx.context(), m_ctx.device()};
+    m_serve_queue.enqueueNDRangeKernel(
+        m_kernel, cl::NullRange, cl::NDRange{m_num_groups * m_local_size}, cl::NDRange{m_local_size}, nullptr,
+        &m_serving
+    );
+    m_serve_queue.flush();
+  }
+
+  void wait_completed(control_slot counter, cl_uint target) const {
+    while (control(counter).load(std::memory_order_acquire) < target) {
+      std::this_thread::yield();
+    }
+  }
+
+  // Copies one piece of the haystack into an arena slot and publishes its spans
+  void publish(std::string_view haystack, std::size_t start, std::size_t slot) {
+    const auto warm = std::min(start, overlap());
+    const auto piece = std::min(slot_payload(), haystack.size() - start);
+    const auto base = slot * slot_size();
+    std::memcpy(m_arena.data() + base, haystack.data() + start - warm, warm + piece);
+
+    const auto first = static_cast<cl_uint>(base + warm);
+    for (std::size_t offset = 0; offset < piece; offset += span_size()) {
+      const auto end = static_cast<cl_uint>(first + std::min(offset + span_size(), piece));
+      m_descriptors[m_published % m_descriptors.size()] =
+          cl_uint4{{first + static_cast<cl_uint>(offset), end, static_cast<cl_uint>(base), static_cast<cl_uint>(slot)}};
+      ++m_slot_published[slot];
+      control(tail).store(++m_published, std::memory_order_release);
+    }
+  }
+
+  std::vector<cl_uint> match_persistent(std::string_view haystack) {
+    std::fill(m_counts.begin(), m_counts.end(), 0);
+
+    // A slot is refilled only after every span published into it is done. Both slots together hold at most as many
+    // spans as the ring, so by then the descriptors about to be overwritten are done as well.
+    for (std::size_t start = 0, piece = 0; start < haystack.size(); start += slot_payload(), ++piece) {
+      const auto slot = piece % 2;
+      wait_completed(static_cast<control_slot>(slot_completed + slot), m_slot_published[slot]);
+      publish(haystack, start, slot);
+    }
+    wait_completed(completed, m_published);
+
+    return std::vector<cl_uint>(m_counts.begin(), m_counts.end());
+  }
+
+  device_counts match_drain(std::string_view haystack) {
+    const auto num_spans = (haystack.size() + span_size() - 1) / span_size();
+    const auto haystack_size = haystack_length(haystack.size(), num_spans, span_size());
+    m_spans.resize(num_spans);
+    for (std::size_t i = 0; i < num_spans; ++i) {
+      const auto start = static_cast<cl_uint>(i * span_size());
+      const auto end = std::min<std::size_t>(start + span_size(), haystack_size);
+      m_spans[i] = cl_uint4{{start, static_cast<cl_uint>(end), 0, 0}};
+    }
+
+    // Control block and descriptors come from the buffer pool, so a stream of batches allocates no device memory
+    const std::array<cl_uint, num_slots> control_init = {0, static_cast<cl_uint>(num_spans), 0, 1, 0, 0};
+    const auto control_size = control_init.size() * sizeof(cl_uint), spans_size = num_spans * sizeof(cl_uint4);
+    auto control_buf = m_ctx.pool().acquire(control_size);
+    auto descriptors = m_ctx.pool().acquire(spans_size);
+    const auto global = std::min(num_spans, m_num_groups) * m_local_size;
+
+    return count_matches(
+        m_ctx, haystack, m_automaton.num_needles(),
+        [&](const auto &deps, const auto &haystack_arg, const auto &counts_arg) {
+          auto waits = deps;
+          const auto &queue = m_ctx.queue();
+          queue.enqueueWriteBuffer(
+              control_buf, CL_FALSE, 0, control_size, control_init.data(), nullptr, &waits.emplace_back()
+          );
+          queue.enqueueWriteBuffer(
+              descriptors, CL_FALSE, 0, spans_size, m_spans.data(), nullptr, &waits.emplace_back()
+          );
+          set_kernel_args(
+              m_kernel, control_buf.buffer(), descriptors.buffer(), static_cast<cl_uint>(num_spans), haystack_arg,
+              m_classes, m_transitions, m_needle_of, m_dict_link, counts_arg
+          );
+
+          cl::Event event;
+          queue.enqueueNDRangeKernel(
+              m_kernel, cl::NullRange, cl::NDRange{global}, cl::NDRange{m_local_size}, &waits, &event
+          );
+          return event;
+        }
+    );
+  }
+
+public:
+  persistent_engine(const device_context &ctx, automaton dfa, unsigned chunk_size = default_chunk_size)
+      : m_ctx{ctx}, m_automaton{std::move(dfa)}, m_chunk_size{chunk_size},
+        m_persistent{supports_svm_atomics(m_ctx.device())}, m_program{build(m_ctx, m_automaton, m_persistent)},
+        m_kernel{m_program, persistent_ac_kernel::entry().c_str()},
+        m_classes{m_ctx, m_automaton.classes().table()},
+        m_transitions{m_ctx, m_automaton.transitions()},
+        m_needle_of{m_ctx, m_automaton.needle_of()},
+        m_dict_link{m_ctx, m_automaton.dict_link()},
+        m_local_size{std::min<std::size_t>(
+            group_size, m_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(m_ctx.device())
+        )},
+        m_num_groups{m_ctx.device().getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * groups_per_unit} {
+    if (m_persistent) start_serving();
+  }
+
+  persistent_engine(const persistent_engine &) = delete;
+  persistent_engine &operator=(const persistent_engine &) = delete;
+
+  ~persistent_engine() override {
+    if (!m_persistent) return;
+
+    // The kernel still reads the SVM arrays, which are freed right after this
+    control(stop).store(1, std::memory_order_release);
+    try {
+      m_serving.wait();
+    } catch (cl::Error &e) {
+      std::cerr << "Error: Persistent kernel failed: " << e.what() << "\n";
+    }
+  }
+
+  match_result match(std::string_view haystack) override {
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+    if (haystack.empty()) return {m_automaton.expand_counts(std::vector<cl_uint>(m_automaton.num_needles(), 0)), {}};
+
+    // The kernel outlives the call and has no event per batch, so only the wall time is known
+    if (m_persistent) {
+      auto counts = match_persistent(haystack);
+      const auto wall = to_millis(std::chrono::high_resolution_clock::now() - wall_start);
+      return {m_automaton.expand_counts(counts), {decltype(wall){std::nan("")}, wall}};
+    }
+
+    const auto [counts, event] = match_drain(haystack);
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+    return {
+        m_automaton.expand_counts(counts), {to_millis(event_duration(event)), to_millis(wall_end - wall_start)}
+    };
+  }
+
+  std::string name() const override { return "ac-persistent"; }
+  std::size_t footprint() const override { return m_automaton.footprint(); }
+  bool persistent() const { return m_persistent; }
+};
+
+} // namespace matching
@@ -0,0 +1,112 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "aho_corasick.hpp"
+#include "device.hpp"
+#include "engine.hpp"
+
+#include "kernelhpp/pfac_kernel.hpp"
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace matching {
+
+// Parallel Failureless Aho-Corasick: one work-item per haystack position walking the trie without failure links
+class pfac_engine : public engine {
+public:
+  // Keep in sync with TRIE_MEMORY_* in kernels/pfac.cl
+  enum class trie_memory : unsigned {
+    global = 0,
+    constant = 1,
+    image = 2
+  };
+
+private:
+  const device_context &m_ctx;
+  automaton m_automaton;
+  trie_memory m_memory;
+
+  cl::Program m_program;
+  cl::Kernel m_kernel;
+  device_array m_classes, m_needle_of, m_trie;
+
+  // Prefer the texture cache, then the constant cache when the whole table fits into it
+  static trie_memory choose_memory(const cl::Device &device, const automaton &dfa) {
+    const auto table_size = dfa.transitions().size() * sizeof(automaton::state_type);
+
+    const bool fits_image = dfa.num_states() <= device.getInfo<CL_DEVICE_IMAGE2D_MAX_HEIGHT>() &&
+                            dfa.num_classes() <= device.getInfo<CL_DEVICE_IMAGE2D_MAX_WIDTH>();
+    if (device.getInfo<CL_DEVICE_IMAGE_SUPPORT>() && fits_image) {
+      return trie_memory::image;
+    }
+
+    // The class table is the other __constant argument of the kernel
+    if (table_size + byte_classes::max_classes <= device.getInfo<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>()) {
+      return trie_memory::constant;
+    }
+
+    return trie_memory::global;
+  }
+
+  device_array make_trie() const {
+    auto trie = m_automaton.trie_transitions();
+    if (m_memory != trie_memory::image) return device_array{m_ctx, trie};
+
+    return device_array{cl::Image2D{
+        m_ctx.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, cl::ImageFormat{CL_R, CL_UNSIGNED_INT32},
+        m_automaton.num_classes(), m_automaton.num_states(), 0, trie.data()}};
+  }
+
+public:
+  pfac_engine(const device_context &ctx, automaton dfa)
+      : m_ctx{ctx}, m_automaton{std::move(dfa)}, m_memory{choose_memory(m_ctx.device(), m_automaton)},
+        m_program{m_ctx.build_program(pfac_kernel::source(m_automaton.num_classes(), static_cast<unsigned>(m_memory)))},
+        m_kernel{m_program, pfac_kernel::entry().c_str()},
+        m_classes{m_ctx, m_automaton.classes().table()},
+        m_needle_of{m_ctx, m_automaton.needle_of()}, m_trie{make_trie()} {}
+
+  match_result match(std::string_view haystack) override {
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+    std::vector<cl_uint> counts(m_automaton.num_needles(), 0);
+
+    if (haystack.empty()) return {m_automaton.expand_counts(counts), {}};
+
+    const auto haystack_size = haystack_length(haystack.size());
+    const auto [device, event] = count_matches(
+        m_ctx, haystack, counts.size(),
+        [&](const auto &deps, const auto &haystack_arg, const auto &counts_arg) {
+          return launch_kernel(
+              m_ctx.queue(), m_kernel, deps, cl::NDRange{haystack.size()}, haystack_arg, haystack_size, m_classes,
+              m_trie, m_needle_of, counts_arg
+          );
+        }
+    );
+
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+    return {
+        m_automaton.expand_counts(device),
+        {to_millis(event_duration(event)), to_millis(wall_end - wall_start)}
+    };
+  }
+
+  std::string name() const override { return "pfac"; }
+  std::size_t footprint() const override {
+    return sizeof(automaton::state_type) * (m_automaton.transitions().size() + m_automaton.needle_of().size()) +
+           byte_classes::max_classes;
+  }
+  trie_memory memory() const { return m_memory; }
+};
+
+} // namespace matching
@@ -0,0 +1,366 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "common/opencl_include.hpp"
+
+#include "alphabet.hpp"
+#include "device.hpp"
+#include "engines.hpp"
+#include "random.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace matching {
+
+struct dictionary_stats {
+  byte_classes classes; // Compacted the same way as engines compact them
+  std::size_t num_needles = 0, num_states = 1, max_length = 0;
+  unsigned num_classes = 0;
+  double mean_length = 0, entropy = 0;                       // Entropy of needle symbols in bits
+  std::vector<std::size_t> length_histogram;                 // Number of needles of every length
+  std::vector<std::size_t> prefixes;                         // Distinct prefixes (trie states) at every depth
+  std::array<double, byte_classes::max_classes> frequency{}; // Relative frequency of every class in needles
+
+  template <typename It>
+  dictionary_stats(It needles_start, It needles_finish, const byte_classes &all_classes = byte_classes::identity())
+      : classes{all_classes.compact(needles_start, needles_finish)}, num_classes{classes.size()} {
+    std::vector<std::string> translated;
+    std::size_t total_length = 0;
+    for (; needles_start != needles_finish; ++needles_start) {
+      std::string needle;
+      for (auto byte : *needles_start) {
+        const auto c = classes(byte);
+        needle.push_back(static_cast<char>(c));
+        frequency[c] += 1;
+      }
+
+      max_length = std::max(max_length, needle.size());
+      if (length_histogram.size() <= needle.size()) length_histogram.resize(needle.size() + 1);
+      ++length_histogram[needle.size()];
+      total_length += needle.size();
+      translated.push_back(std::move(needle));
+    }
+
+    num_needles = translated.size();
+    if (!num_needles) return;
+
+    mean_length = static_cast<double>(total_length) / num_needles;
+    for (auto &f : frequency) {
+      f /= total_length;
+      if (f > 0) entropy -= f * std::log2(f);
+    }
+
+    // In sorted order every needle adds the prefixes longer than its common prefix with the previous one
+    std::sort(translated.begin(), translated.end());
+    prefixes.assign(max_length + 1, 0);
+    std::string_view prev;
+    for (std::string_view curr : translated) {
+      auto lcp = std::mismatch(prev.begin(), prev.end(), curr.begin(), curr.end()).first - prev.begin();
+      for (auto d = lcp + 1; d <= static_cast<std::ptrdiff_t>(curr.size()); ++d) {
+        ++prefixes[d];
+        ++num_states;
+      }
+      prev = curr;
+    }
+  }
+
+  // Probability that a haystack symbol equals a random needle symbol, estimated from a haystack sample
+  double match_probability(std::string_view sample) const {
+    if (sample.empty()) return std::pow(2.0, -entropy);
+
+    std::array<double, byte_classes::max_classes> haystack_frequency{};
+    for (auto byte : sample) {
+      haystack_frequency[classes(byte)] += 1.0 / sample.size();
+    }
+
+    double probability = 0;
+    for (unsigned c = 0; c < byte_classes::max_classes; ++c) {
+      probability += frequency[c] * haystack_frequency[c];
+    }
+    return probability;
+  }
+
+  // Expected number of trie steps a PFAC work-item makes before it dies
+  double expected_walk(double match_probability) const {
+    double walk = 0, probability = 1;
+    for (std::size_t d = 1; d < prefixes.size(); ++d) {
+      probability *= match_probability;
+      walk += std::min(1.0, prefixes[d] * probability);
+    }
+    return walk;
+  }
+};
+
+// Symbol statistics don't need the whole haystack
+inline std::string_view sample_haystack(std::string_view haystack) {
+  constexpr std::size_t sample_size = 1 << 20;
+  return haystack.substr(0, sample_size);
+}
+
+struct device_stats {
+  std::string name;
+  cl_device_type type;
+  unsigned compute_units;
+  std::size_t max_work_group_size;
+  cl_ulong global_mem_size, global_cache_size, max_alloc_size, max_constant_size, local_mem_size;
+  bool image_support;
+
+  explicit device_stats(const cl::Device &device)
+      : name{device.getInfo<CL_DEVICE_NAME>()}, type{device.getInfo<CL_DEVICE_TYPE>()},
+        compute_units{device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>()},
+        max_work_group_size{device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>()},
+        global_mem_size{device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>()},
+        global_cache_size{std::max<cl_ulong>(device.getInfo<CL_DEVICE_GLOBAL_MEM_CACHE_SIZE>(), 1)},
+        max_alloc_size{device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>()},
+        max_constant_size{device.getInfo<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>()},
+        local_mem_size{device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>()},
+        image_support{static_cast<bool>(device.getInfo<CL_DEVICE_IMAGE_SUPPORT>())} {}
+};
+
+// Everything the cost model knows about a job
+struct workload {
+  dictionary_stats dictionary;
+  device_stats device;
+  std::size_t haystack_size;
+  double match_probability;
+};
+
+struct plan {
+  std::string engine;
+  unsigned chunk_size = default_chunk_size;
+  double predicted_ms = 0;
+};
+
+inline std::ostream &operator<<(std::ostream &os, const plan &p) {
+  return os << "engine: " << p.engine << ", chunk size: " << p.chunk_size << ", predicted time: " << p.predicted_ms
+            << " ms";
+}
+
+// Linear model of the kernel time of every engine: t = c0 + c1 * n + c2 * n * penalty, where n is the haystack size
+// and the penalty describes how much work per byte the engine does on top of a single table lookup.
+class cost_model {
+public:
+  using coefficients = std::array<double, 3>;
+  using features = std::array<double, 3>;
+
+private:
+  std::map<std::string, coefficients, std::less<>> m_coefficients;
+
+  static double cache_penalty(std::size_t table_size, const device_stats &device) {
+    return std::log2(std::max(1.0, static_cast<double>(table_size) / device.global_cache_size));
+  }
+
+public:
+  // Rough numbers for a discrete GPU, meant to be replaced by calibrate()
+  cost_model() {
+    m_coefficients["ac"] = {0.05, 2e-6, 1e-6};
+    m_coefficients["pfac"] = {0.05, 1e-6, 1e-6};
+    m_coefficients["ac-compressed"] = {0.05, 2e-6, 2e-6};
+  }
+
+  // Engines that can't run the workload at all have no features
+  static std::optional<features> make_features(std::string_view engine, const workload &w) {
+    const auto &d = w.dictionary;
+    const auto n = static_cast<double>(w.haystack_size);
+    const auto table_size = d.num_states * d.num_classes * sizeof(cl_uint);
+    const auto compressed_size = d.num_states * (6 * sizeof(cl_uint) + 1);
+
+    if (engine == "ac" || engine == "pfac") {
+      if (table_size > w.device.max_alloc_size) return std::nullopt;
+      if (engine == "ac") return features{1, n, n * cache_penalty(table_size, w.device)};
+      return features{1, n, n * d.expected_walk(w.match_probability)};
+    }
+
+    if (engine == "ac-compressed") {
+      if (compressed_size > w.device.max_alloc_size) return std::nullopt;
+      return features{1, n, n * (1 + cache_penalty(compressed_size, w.device))};
+    }
+
+    return std::nullopt;
+  }
+
+  std::optional<double> predict(std::string_view engine, const workload &w) const {
+    auto found = m_coefficients.find(engine);
+    auto f = make_features(engine, w);
+    if (found == m_coefficients.end() || !f) return std::nullopt;
+
+    double time = 0;
+    for (unsigned i = 0; i < f->size(); ++i) {
+      time += found->second[i] * (*f)[i];
+    }
+    return time;
+  }
+
+  // Least squares fit of the coefficients of one engine. Negative coefficients make no physical sense and are clamped.
+  void fit(const std::string &engine, const std::vector<std::pair<features, double>> &samples) {
+    constexpr unsigned n = std::tuple_size_v<features>;
+    std::array<std::array<double, n + 1>, n> system{};
+
+    for (const auto &[f, time] : samples) {
+      for (unsigned i = 0; i < n; ++i) {
+        for (unsigned j = 0; j < n; ++j) {
+          system[i][j] += f[i] * f[j];
+        }
+        system[i][n] += f[i] * time;
+      }
+    }
+
+    // Gaussian elimination with partial pivoting and a tiny ridge term for degenerate sample sets
+    for (unsigned i = 0; i < n; ++i) {
+      system[i][i] += 1e-9 * (system[i][i] + 1);
+    }
+
+    for (unsigned col = 0; col < n; ++col) {
+      const auto pivot = std::max_element(system.begin() + col, system.end(), [col](auto &lhs, auto &rhs) {
+        return std::abs(lhs[col]) < std::abs(rhs[col]);
+      });
+      std::swap(system[col], *pivot);
+
+      for (unsigned row = 0; row < n; ++row) {
+        if (row == col) continue;
+        const auto factor = system[row][col] / system[col][col];
+        for (unsigned k = col; k <= n; ++k) {
+          system[row][k] -= factor * system[col][k];
+        }
+      }
+    }
+
+    auto &c = m_coefficients[engine];
+    for (unsigned i = 0; i < n; ++i) {
+      c[i] = std::max(0.0, system[i][n] / system[i][i]);
+    }
+  }
+
+  // One line per engine: name followed by the coefficients
+  void save(std::ostream &os) const {
+    os.precision(std::numeric_limits<double>::max_digits10);
+    for (const auto &[engine, c] : m_coefficients) {
+      os << engine << " " << c[0] << " " << c[1] << " " << c[2] << "\n";
+    }
+  }
+
+  void load(std::istream &is) {
+    std::string engine;
+    coefficients c;
+    while (is >> engine >> c[0] >> c[1] >> c[2]) {
+      m_coefficients[engine] = c;
+    }
+  }
+
+  void save(const std::string &path) const {
+    std::ofstream os{path};
+    if (!os) throw std::runtime_error{"Can't open cost model file " + path};
+    save(os);
+  }
+
+  void load(const std::string &path) {
+    std::ifstream is{path};
+    if (!is) throw std::runtime_error{"Can't open cost model file " + path};
+    load(is);
+  }
+
+  const auto &get_coefficients() const { return m_coefficients; }
+};
+
+// Chunks should be long enough to amortize the overlap with the previous chunk, but there have to be enough of them
+// to occupy every compute unit
+inline unsigned choose_chunk_size(const workload &w) {
+  const auto min_chunk = std::min<std::size_t>(std::max<std::size_t>(256, 8 * w.dictionary.max_length), 65536);
+  const auto work_items = std::max<std::size_t>(1, w.device.compute_units * w.device.max_work_group_size * 4);
+  const auto chunk = std::clamp<std::size_t>(w.haystack_size / work_items, min_chunk, 65536);
+  return static_cast<unsigned>(std::bit_ceil(chunk));
+}
+
+inline plan make_plan(const cost_model &model, const workload &w) {
+  if (w.dictionary.num_needles == 1) return plan{std::string{two_way_engine_name}, choose_chunk_size(w)};
+
+  std::optional<plan> best;
+
+  for (std::string engine : engine_names) {
+    auto predicted = model.predict(engine, w);
+    if (!predicted) continue;
+    if (!best || *predicted < best->predicted_ms) best = plan{engine, choose_chunk_size(w), *predicted};
+  }
+
+  if (!best) throw std::runtime_error{"No engine can handle the dictionary on this device"};
+  return *best;
+}
+
+inline std::unique_ptr<engine> make_engine(
+    const plan &p, const device_context &ctx, const std::vector<std::string> &needles,
+    const byte_classes &classes = byte_classes::identity()
+) {
+  return make_engine(p.engine, ctx, needles, classes, p.chunk_size);
+}
+
+// Run every engine on a set of synthetic workloads and fit the coefficients to the measured kernel times
+inline cost_model calibrate(const device_context &ctx, std::ostream *log = nullptr) {
+  constexpr std::array alphabets = {"acgt", "abcdefghijklmnopqrstuvwxyz"};
+  constexpr std::array dictionary_sizes = {16u, 1024u, 65536u};
+  constexpr std::array haystack_sizes = {std::size_t{8} << 20, std::size_t{32} << 20};
+  constexpr unsigned repetitions = 3;
+
+  const device_stats device{ctx.device()};
+  std::map<std::string, std::vector<std::pair<cost_model::features, double>>> samples;
+
+  for (std::string alphabet : alphabets) {
+    for (auto size : haystack_sizes) {
+      const auto haystack = random_haystack(size, alphabet);
+
+      for (auto count : dictionary_sizes) {
+        const auto needles = random_dictionary(haystack, count, 4, 16);
+        const dictionary_stats stats{needles.begin(), needles.end()};
+        const workload w{stats, device, haystack.size(), stats.match_probability(sample_haystack(haystack))};
+
+        for (std::string name : engine_names) {
+          auto f = cost_model::make_features(name, w);
+          if (!f) continue;
+
+          auto engine = make_engine(name, ctx, needles, byte_classes::identity(), choose_chunk_size(w));
+          auto best = std::numeric_limits<double>::max();
+          for (unsigned i = 0; i < repetitions; ++i) {
+            best = std::min(best, engine->match(haystack).time.pure.count());
+          }
+
+          samples[name].emplace_back(*f, best);
+          if (log) {
+            *log << "Calibration: " << name << ", alphabet " << alphabet.size() << ", needles " << count
+                 << ", haystack " << size << ": " << best << " ms\n";
+          }
+        }
+      }
+    }
+  }
+
+  cost_model model;
+  for (const auto &[name, s] : samples) {
+    model.fit(name, s);
+  }
+  return model;
+}
+
+} // namespace matching
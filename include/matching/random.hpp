@@ -0,0 +1,98 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "common/utils.hpp"
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace matching {
+
+inline std::string random_haystack(std::size_t size, const std::string &alphabet) {
+  std::vector<unsigned> symbols(size);
+  clutils::create_random_number_generator<unsigned>(0, alphabet.size() - 1)(symbols);
+
+  std::string haystack(size, '\0');
+  std::transform(symbols.begin(), symbols.end(), haystack.begin(), [&](auto s) { return alphabet[s]; });
+  return haystack;
+}
+
+// Contention-heavy haystack: `count` random words of the alphabet repeated back to back in random order, so that the
+// same few needles match all the time
+inline std::string repeated_haystack(
+    std::size_t size, const std::string &alphabet, unsigned count, unsigned min_length, unsigned max_length
+) {
+  std::vector<unsigned> lengths(count);
+  clutils::create_random_number_generator<unsigned>(min_length, max_length)(lengths);
+
+  std::vector<std::string> words;
+  for (const auto length : lengths) {
+    words.push_back(random_haystack(length, alphabet));
+  }
+
+  std::vector<unsigned> order(size / min_length + 1);
+  clutils::create_random_number_generator<unsigned>(0, count - 1)(order);
+
+  std::string haystack;
+  haystack.reserve(size + max_length);
+  for (std::size_t i = 0; haystack.size() < size; ++i) {
+    haystack += words[order[i]];
+  }
+
+  haystack.resize(size);
+  return haystack;
+}
+
+// Needles are cut out of the haystack so that every one of them has at least one match
+inline std::vector<std::string>
+random_dictionary(const std::string &haystack, unsigned count, unsigned min_length, unsigned max_length) {
+  std::vector<unsigned> lengths(count), positions(count);
+  clutils::create_random_number_generator<unsigned>(min_length, max_length)(lengths);
+  clutils::create_random_number_generator<unsigned>(0, haystack.size() - max_length)(positions);
+
+  std::vector<std::string> needles;
+  for (unsigned i = 0; i < count; ++i) {
+    needles.push_back(haystack.substr(positions[i], lengths[i]));
+  }
+
+  return needles;
+}
+
+// Patterns of `length` bytes cut from the haystack with every `wildcard_every`-th byte on average replaced by `?`.
+// Kept bytes are written as \xHH escapes.
+inline std::vector<std::string>
+random_masked_patterns(const std::string &haystack, unsigned count, unsigned length, unsigned wildcard_every = 4) {
+  std::vector<unsigned> positions(count), draws(std::size_t{count} * length);
+  clutils::create_random_number_generator<unsigned>(0, haystack.size() - length)(positions);
+  clutils::create_random_number_generator<unsigned>(0, wildcard_every - 1)(draws);
+
+  constexpr std::string_view digits = "0123456789abcdef";
+  std::vector<std::string> patterns;
+  for (unsigned i = 0; i < count; ++i) {
+    std::string pattern;
+    for (unsigned j = 0; j < length; ++j) {
+      if (draws[std::size_t{i} * length + j] == 0) {
+        pattern += '?';
+        continue;
+      }
+      const auto byte = static_cast<unsigned char>(haystack[positions[i] + j]);
+      pattern += {'\\', 'x', digits[byte >> 4], digits[byte & 15]};
+    }
+    patterns.push_back(std::move(pattern));
+  }
+
+  return patterns;
+}
+
+} // namespace matching
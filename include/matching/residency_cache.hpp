@@ -0,0 +1,149 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "common/mapped_file.hpp"
+#include "common/opencl_include.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+
+namespace matching {
+
+// Device-resident copies of haystack files, kept between jobs of a long-running matcher. Files are identified by path,
+// modification time and size; a file that changed on disk is dropped and uploaded again. The host side is a mapping
+// of the file, so a hit touches neither the disk nor the bus, and its address is how the counting pass finds the
+// resident buffer. Entries are evicted in LRU order once the resident bytes would exceed the capacity, which defaults
+// to half of the device global memory to leave room for automata and the buffer pool.
+class residency_cache {
+public:
+  struct statistics {
+    std::size_t hits = 0, misses = 0, evictions = 0, uncacheable = 0;
+    std::size_t resident_bytes = 0, capacity = 0;
+
+    double hit_rate() const { return (hits + misses) ? static_cast<double>(hits) / (hits + misses) : 0; }
+  };
+
+private:
+  struct entry {
+    std::string path;
+    std::filesystem::file_time_type mtime;
+    std::uintmax_t size;
+    clutils::mapped_file host;
+    cl::Buffer device;
+  };
+
+  cl::Context m_context;
+  cl::CommandQueue m_queue;
+  std::size_t m_max_alloc;
+
+  std::list<entry> m_entries; // Most recently used first
+  std::unordered_map<std::string, std::list<entry>::iterator> m_by_path;
+  std::unordered_map<const char *, std::list<entry>::iterator> m_by_address;
+  statistics m_stats;
+  mutable std::mutex m_mutex;
+
+  void evict(std::list<entry>::iterator it) {
+    m_stats.resident_bytes -= it->size;
+    m_by_path.erase(it->path);
+    m_by_address.erase(it->host.data().data());
+    m_entries.erase(it);
+  }
+
+public:
+  residency_cache(cl::Context context, cl::CommandQueue queue, const cl::Device &device, std::size_t capacity = 0)
+      : m_context{std::move(context)}, m_queue{std::move(queue)},
+        m_max_alloc{device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>()} {
+    m_stats.capacity = (capacity ? capacity : device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>() / 2);
+  }
+
+  residency_cache(const residency_cache &) = delete;
+  residency_cache &operator=(const residency_cache &) = delete;
+
+  // Host view of the file, resident on the device until it is evicted by a later call. Empty files, files that do not
+  // fit into a single device allocation or into the cache, pipes and files that can't be stat'ed are not cached, and
+  // the caller reads them as usual.
+  std::optional<std::string_view> acquire(const std::string &path) {
+    std::error_code mtime_error, size_error;
+    const auto mtime = std::filesystem::last_write_time(path, mtime_error);
+    const auto size = std::filesystem::file_size(path, size_error);
+
+    std::lock_guard lock{m_mutex};
+    if (mtime_error || size_error) {
+      if (const auto found = m_by_path.find(path); found != m_by_path.end()) evict(found->second);
+      ++m_stats.misses;
+      ++m_stats.uncacheable;
+      return std::nullopt;
+    }
+
+    if (const auto found = m_by_path.find(path); found != m_by_path.end()) {
+      const auto it = found->second;
+      if (it->mtime == mtime && it->size == size) {
+        ++m_stats.hits;
+        m_entries.splice(m_entries.begin(), m_entries, it);
+        return it->host.data();
+      }
+      evict(it);
+    }
+
+    ++m_stats.misses;
+    if (size == 0 || size > m_max_alloc || size > m_stats.capacity) {
+      ++m_stats.uncacheable;
+      return std::nullopt;
+    }
+
+    while (m_stats.resident_bytes + size > m_stats.capacity) {
+      evict(std::prev(m_entries.end()));
+      ++m_stats.evictions;
+    }
+
+    clutils::mapped_file host{path};
+    const auto data = host.data();
+    cl::Buffer device{m_context, CL_MEM_READ_ONLY, data.size()};
+    m_queue.enqueueWriteBuffer(device, CL_TRUE, 0, data.size(), data.data());
+
+    m_entries.push_front(entry{path, mtime, size, std::move(host), std::move(device)});
+    m_by_path.emplace(path, m_entries.begin());
+    m_by_address.emplace(data.data(), m_entries.begin());
+    m_stats.resident_bytes += size;
+    return data;
+  }
+
+  // Resident buffer holding exactly this haystack, or nullptr if it was not returned by `acquire`
+  const cl::Buffer *find(std::string_view haystack) const {
+    std::lock_guard lock{m_mutex};
+    const auto found = m_by_address.find(haystack.data());
+    if (found == m_by_address.end() || found->second->host.data().size() != haystack.size()) return nullptr;
+    return &found->second->device;
+  }
+
+  statistics stats() const {
+    std::lock_guard lock{m_mutex};
+    return m_stats;
+  }
+};
+
+inline std::ostream &operator<<(std::ostream &os, const residency_cache::statistics &stats) {
+  return os << "hits: " << stats.hits << ", misses: " << stats.misses << ", hit rate: " << stats.hit_rate() * 100
+            << "%, evictions: " << stats.evictions << ", uncacheable: " << stats.uncacheable
+            << ", resident: " << stats.resident_bytes << " of " << stats.capacity << " bytes";
+}
+
+} // namespace matching
@@ -0,0 +1,467 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "io.hpp"
+
+#include "common/bounded_queue.hpp"
+#include "common/thread_pool.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifdef MATCHING_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef MATCHING_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace matching {
+
+enum class compression { none, gzip, zstd };
+
+inline compression detect_compression(std::string_view head) {
+  const auto starts_with = [head](std::string_view magic) { return head.substr(0, magic.size()) == magic; };
+  if (starts_with("\x1f\x8b")) return compression::gzip;
+  if (starts_with("\x28\xb5\x2f\xfd")) return compression::zstd;
+  return compression::none;
+}
+
+inline std::string to_string(compression format) {
+  switch (format) {
+  case compression::gzip: return "gzip";
+  case compression::zstd: return "zstd";
+  default: return "none";
+  }
+}
+
+namespace detail {
+
+inline constexpr std::size_t stream_block_size = 1 << 20;
+
+// Reads from a byte range, for decoders that take a `read(buffer, size) -> bytes read` callable
+inline auto memory_reader(std::string_view data) {
+  return [data](char *buffer, std::size_t size) mutable {
+    const auto n = std::min(size, data.size());
+    std::copy_n(data.data(), n, buffer);
+    data.remove_prefix(n);
+    return n;
+  };
+}
+
+inline auto file_reader(std::istream &is) {
+  return [&is](char *buffer, std::size_t size) {
+    is.read(buffer, static_cast<std::streamsize>(size));
+    return static_cast<std::size_t>(is.gcount());
+  };
+}
+
+// Decodes independent pieces on the pool, at most a window of them at a time, and emits the results in order
+template <typename Decode, typename Emit>
+void decode_parallel(
+    const std::vector<std::string_view> &pieces, Decode decode, Emit emit, clutils::thread_pool &pool
+) {
+  const auto window = 2 * pool.size();
+  std::deque<std::future<std::string>> decoded;
+
+  for (std::size_t next = 0; next < pieces.size() || !decoded.empty();) {
+    for (; next < pieces.size() && decoded.size() < window; ++next) {
+      decoded.push_back(pool.submit([&decode, piece = pieces[next]] { return decode(piece); }));
+    }
+
+    // Pieces still in flight refer to `decode`, so they are drained before leaving on an error or an early stop
+    bool keep_going = true;
+    try {
+      keep_going = emit(pool.wait(decoded.front()));
+    } catch (...) {
+      for (auto &rest : decoded) {
+        rest.wait();
+      }
+      throw;
+    }
+
+    decoded.pop_front();
+    if (!keep_going) {
+      for (auto &rest : decoded) {
+        rest.wait();
+      }
+      return;
+    }
+  }
+}
+
+#ifdef MATCHING_WITH_ZLIB
+// Size of a BGZF member (a gzip member whose "BC" extra subfield stores its compressed size), 0 for other members
+inline std::size_t bgzf_member_size(std::string_view member) {
+  const auto byte = [member](std::size_t i) -> std::size_t { return static_cast<unsigned char>(member[i]); };
+  constexpr std::size_t header_size = 12, flag_extra = 4;
+  if (member.size() < header_size || byte(0) != 0x1f || byte(1) != 0x8b || !(byte(3) & flag_extra)) return 0;
+
+  const auto extra_end = std::min(header_size + (byte(10) | byte(11) << 8), member.size());
+  for (auto pos = header_size; pos + 4 <= extra_end;) {
+    const auto length = byte(pos + 2) | byte(pos + 3) << 8;
+    if (byte(pos) == 'B' && byte(pos + 1) == 'C' && length == 2 && pos + 6 <= extra_end) {
+      return (byte(pos + 4) | byte(pos + 5) << 8) + 1;
+    }
+    pos += 4 + length;
+  }
+
+  return 0;
+}
+
+// Members of a BGZF file, empty if the data is not BGZF throughout
+inline std::vector<std::string_view> bgzf_members(std::string_view data) {
+  std::vector<std::string_view> members;
+  for (std::size_t pos = 0; pos < data.size();) {
+    const auto size = bgzf_member_size(data.substr(pos));
+    if (size == 0 || size > data.size() - pos) return {};
+    members.push_back(data.substr(pos, size));
+    pos += size;
+  }
+  return members;
+}
+
+// Inflates consecutive gzip members, passing decoded blocks to `emit` until it returns false
+template <typename Read, typename Emit> void inflate_stream(Read read, Emit emit) {
+  z_stream zs{};
+  if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK) throw std::runtime_error{"Can't initialize zlib"};
+  const std::unique_ptr<z_stream, decltype(&inflateEnd)> guard{&zs, inflateEnd};
+
+  std::vector<char> input(stream_block_size);
+  int status = Z_OK;
+  bool flushed = true;
+
+  for (;;) {
+    // Output left inside zlib after a full block is taken before reading further
+    if (zs.avail_in == 0 && flushed) {
+      zs.avail_in = static_cast<uInt>(read(input.data(), input.size()));
+      zs.next_in = reinterpret_cast<Bytef *>(input.data());
+      if (zs.avail_in == 0) break;
+    }
+
+    std::string block(stream_block_size, '\0');
+    zs.next_out = reinterpret_cast<Bytef *>(block.data());
+    zs.avail_out = static_cast<uInt>(block.size());
+
+    status = inflate(&zs, Z_NO_FLUSH);
+    if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+      throw std::runtime_error{"Corrupt gzip stream"};
+    }
+
+    flushed = (zs.avail_out != 0);
+    block.resize(block.size() - zs.avail_out);
+    if (!block.empty() && !emit(std::move(block))) return;
+    if (status == Z_STREAM_END) inflateReset(&zs);
+  }
+
+  if (status != Z_STREAM_END) throw std::runtime_error{"Truncated gzip stream"};
+}
+
+inline std::string inflate_member(std::string_view member) {
+  std::string decoded;
+  inflate_stream(memory_reader(member), [&decoded](std::string block) {
+    decoded += block;
+    return true;
+  });
+  return decoded;
+}
+#endif
+
+#ifdef MATCHING_WITH_ZSTD
+// Frames of a zstd file, found from frame headers without decoding them
+inline std::vector<std::string_view> zstd_frames(std::string_view data) {
+  std::vector<std::string_view> frames;
+  for (std::size_t pos = 0; pos < data.size();) {
+    const auto size = ZSTD_findFrameCompressedSize(data.data() + pos, data.size() - pos);
+    if (ZSTD_isError(size)) throw std::runtime_error{"Corrupt zstd stream"};
+    frames.push_back(data.substr(pos, size));
+    pos += size;
+  }
+  return frames;
+}
+
+// Decompresses consecutive zstd frames, passing decoded blocks to `emit` until it returns false
+template <typename Read, typename Emit> void zstd_stream(Read read, Emit emit) {
+  const std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx{ZSTD_createDCtx(), ZSTD_freeDCtx};
+  if (!dctx) throw std::runtime_error{"Can't initialize zstd"};
+
+  std::vector<char> input(ZSTD_DStreamInSize());
+  std::size_t status = 0;
+
+  // A frame's last input byte is consumed only after all of its output is flushed
+  while (const auto size = read(input.data(), input.size())) {
+    ZSTD_inBuffer in{input.data(), size, 0};
+    while (in.pos < in.size) {
+      std::string block(stream_block_size, '\0');
+      ZSTD_outBuffer out{block.data(), block.size(), 0};
+
+      status = ZSTD_decompressStream(dctx.get(), &out, &in);
+      if (ZSTD_isError(status)) throw std::runtime_error{"Corrupt zstd stream"};
+
+      block.resize(out.pos);
+      if (!block.empty() && !emit(std::move(block))) return;
+    }
+  }
+
+  if (status != 0) throw std::runtime_error{"Truncated zstd stream"};
+}
+
+inline std::string zstd_frame(std::string_view frame) {
+  const auto size = ZSTD_getFrameContentSize(frame.data(), frame.size());
+  std::string decoded;
+
+  if (size != ZSTD_CONTENTSIZE_UNKNOWN && size != ZSTD_CONTENTSIZE_ERROR) {
+    decoded.resize(size);
+    const auto written = ZSTD_decompress(decoded.data(), decoded.size(), frame.data(), frame.size());
+    if (ZSTD_isError(written) || written != size) throw std::runtime_error{"Corrupt zstd frame"};
+    return decoded;
+  }
+
+  zstd_stream(memory_reader(frame), [&decoded](std::string block) {
+    decoded += block;
+    return true;
+  });
+  return decoded;
+}
+#endif
+
+} // namespace detail
+
+// Input file opened once. Its format is told from the first bytes, which are kept and served again before the rest of
+// the stream, since pipes and process substitutions can be neither reopened nor rewound.
+class input_file {
+  static constexpr std::size_t head_size = 64;
+
+  std::string m_path;
+  std::ifstream m_stream;
+  std::string m_head;
+  std::size_t m_head_read = 0;
+  std::optional<std::size_t> m_size; // Known for seekable files only
+  compression m_format;
+
+public:
+  explicit input_file(std::string path) : m_path{std::move(path)}, m_stream{m_path, std::ios::binary} {
+    if (!m_stream) throw std::runtime_error{"Can't open input file " + m_path};
+
+    if (m_stream.seekg(0, std::ios::end)) {
+      if (const auto end = m_stream.tellg(); end != std::streampos{-1}) m_size = static_cast<std::size_t>(end);
+    }
+    m_stream.clear();
+    if (m_size) m_stream.seekg(0);
+
+    m_head.resize(head_size);
+    m_head.resize(detail::file_reader(m_stream)(m_head.data(), m_head.size()));
+    m_format = detect_compression(std::string_view{m_head});
+  }
+
+  // Reads up to `size` bytes, fewer only at the end of the file
+  std::size_t read(char *buffer, std::size_t size) {
+    const auto from_head = std::min(size, m_head.size() - m_head_read);
+    std::copy_n(m_head.data() + m_head_read, from_head, buffer);
+    m_head_read += from_head;
+    if (from_head == size) return size;
+    return from_head + detail::file_reader(m_stream)(buffer + from_head, size - from_head);
+  }
+
+  // The rest of the file, read in one go when its size is known and in blocks otherwise
+  template <typename Container = std::string> Container read_all(Container buffer = {}) {
+    if (m_size && m_head_read == 0) {
+      buffer.resize(*m_size);
+      if (read(buffer.data(), buffer.size()) != buffer.size()) {
+        throw std::runtime_error{"Can't read input file " + m_path};
+      }
+      return buffer;
+    }
+
+    std::size_t size = 0;
+    for (std::size_t n = detail::stream_block_size; n == detail::stream_block_size;) {
+      buffer.resize(size + detail::stream_block_size);
+      n = read(buffer.data() + size, detail::stream_block_size);
+      size += n;
+    }
+    buffer.resize(size);
+    return buffer;
+  }
+
+  const std::string &path() const { return m_path; }
+  const std::string &head() const { return m_head; }
+  compression format() const { return m_format; }
+};
+
+// Decoded contents of a file as a sequence of blocks, produced by a separate thread while the consumer works on the
+// previous ones. BGZF gzip files and multi-frame zstd files (bgzip, zstd -T, pzstd) are split into their independent
+// members and frames, which are decoded in parallel on the pool. A plain gzip stream can only be inflated
+// sequentially, so it takes one thread. Uncompressed files are passed through in blocks.
+class decompressing_reader {
+  input_file m_input;
+  compression m_format;
+  clutils::bounded_queue<std::string> m_blocks;
+  std::thread m_producer;
+
+  void produce(clutils::thread_pool &pool) {
+    const auto read = [this](char *buffer, std::size_t size) { return m_input.read(buffer, size); };
+    const auto emit = [this](std::string block) { return m_blocks.push(std::move(block)); };
+    [[maybe_unused]] const auto decode_all = [&](auto split, auto decode, auto sequential) {
+      // The compressed file is read whole to find the pieces, the plaintext never is
+      const auto data = m_input.read_all();
+      const auto pieces = split(data);
+      if (pieces.size() > 1) return detail::decode_parallel(pieces, decode, emit, pool);
+      sequential(detail::memory_reader(data), emit);
+    };
+
+    switch (m_format) {
+    case compression::none:
+      for (std::size_t n = detail::stream_block_size; n == detail::stream_block_size;) {
+        std::string block(detail::stream_block_size, '\0');
+        n = read(block.data(), block.size());
+        block.resize(n);
+        if (!block.empty() && !emit(std::move(block))) return;
+      }
+      return;
+
+    case compression::gzip:
+#ifdef MATCHING_WITH_ZLIB
+    {
+      if (detail::bgzf_member_size(m_input.head()) == 0) return detail::inflate_stream(read, emit);
+      return decode_all(
+          detail::bgzf_members, detail::inflate_member,
+          [](auto read, auto sink) { detail::inflate_stream(read, sink); }
+      );
+    }
+#else
+      throw std::runtime_error{"Built without gzip support, can't read " + m_input.path()};
+#endif
+
+    case compression::zstd:
+#ifdef MATCHING_WITH_ZSTD
+      return decode_all(
+          detail::zstd_frames, detail::zstd_frame, [](auto read, auto sink) { detail::zstd_stream(read, sink); }
+      );
+#else
+      throw std::runtime_error{"Built without zstd support, can't read " + m_input.path()};
+#endif
+    }
+  }
+
+public:
+  // `queue_depth` blocks are decoded ahead of the consumer at most
+  explicit decompressing_reader(
+      input_file input, clutils::thread_pool &pool = clutils::default_thread_pool(), std::size_t queue_depth = 8
+  )
+      : m_input{std::move(input)}, m_format{m_input.format()}, m_blocks{queue_depth} {
+    m_producer = std::thread{[this, &pool] {
+      try {
+        produce(pool);
+        m_blocks.close();
+      } catch (...) {
+        m_blocks.fail(std::current_exception());
+      }
+    }};
+  }
+
+  explicit decompressing_reader(
+      const std::string &path, clutils::thread_pool &pool = clutils::default_thread_pool(), std::size_t queue_depth = 8
+  )
+      : decompressing_reader{input_file{path}, pool, queue_depth} {}
+
+  decompressing_reader(const decompressing_reader &) = delete;
+  decompressing_reader &operator=(const decompressing_reader &) = delete;
+
+  ~decompressing_reader() {
+    m_blocks.close();
+    m_producer.join();
+  }
+
+  compression format() const { return m_format; }
+
+  // Next decoded block, empty at the end of the file. Decoding errors are rethrown here.
+  std::optional<std::string> next() { return m_blocks.pop(); }
+};
+
+// Reads the whole decoded stream into `buffer`, for consumers that need the plaintext in one piece
+template <typename Container> Container read_stream(decompressing_reader &reader, Container buffer) {
+  buffer.clear();
+  while (auto block = reader.next()) {
+    buffer.insert(buffer.end(), block->begin(), block->end());
+  }
+  return buffer;
+}
+
+// Counts needles over a decoded stream without holding all of it. Blocks are gathered into `chunk`, which is reused
+// for the whole stream (typically a pinned buffer), and every chunk starts with the last max_len - 1 bytes of the
+// previous one. Matches lying entirely inside that carried tail were counted before and are subtracted with the
+// boundary automaton, as with NUMA shards. `match(chunk)` returns the counts of one chunk.
+template <typename Container, typename Automaton, typename Match>
+std::vector<unsigned> match_stream(
+    decompressing_reader &reader, Container &chunk, std::size_t chunk_size, Automaton &boundary, Match match
+) {
+  const auto overlap = boundary.max_needle_length() - 1;
+  std::vector<unsigned> total(boundary.num_needles(), 0);
+
+  chunk.clear();
+  chunk.reserve(overlap + chunk_size);
+
+  std::string block;
+  std::size_t consumed = 0;
+
+  for (bool more = true; more;) {
+    const auto carried = chunk.size();
+    while (chunk.size() < carried + chunk_size) {
+      if (consumed == block.size()) {
+        auto next = reader.next();
+        if (!next) {
+          more = false;
+          break;
+        }
+        block = std::move(*next);
+        consumed = 0;
+        continue;
+      }
+
+      const auto take = std::min(block.size() - consumed, carried + chunk_size - chunk.size());
+      chunk.insert(chunk.end(), block.begin() + consumed, block.begin() + consumed + take);
+      consumed += take;
+    }
+
+    if (chunk.size() == carried) break;
+
+    const auto counts = match(std::string_view{chunk.data(), chunk.size()});
+    std::transform(total.begin(), total.end(), counts.begin(), total.begin(), std::plus{});
+
+    // Unsigned counters may wrap here, the counts of the chunk added above bring them back
+    if (carried != 0) {
+      const auto duplicates = boundary.count({chunk.data(), carried});
+      std::transform(total.begin(), total.end(), duplicates.begin(), total.begin(), std::minus{});
+    }
+
+    const auto keep = std::min(overlap, chunk.size());
+    std::copy(chunk.end() - keep, chunk.end(), chunk.begin());
+    chunk.resize(keep);
+  }
+
+  return total;
+}
+
+} // namespace matching
@@ -0,0 +1,124 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace matching {
+
+// Element `index` of a haystack of `Element`s stored as raw bytes in host order
+template <typename Element> Element load_element(std::string_view haystack, std::size_t index) {
+  Element element;
+  std::memcpy(&element, haystack.data() + index * sizeof(Element), sizeof(Element));
+  return element;
+}
+
+// Equivalence classes of wide symbols, such as token ids or opcodes, for alphabets too large for a byte_classes style
+// table. Every symbol that occurs in a needle is a class of its own and all the others share class 0, the same way
+// compacted byte classes treat unused bytes. Classes are found in an open-addressing hash table of (symbol, class)
+// pairs with linear probing, at most half full, where class 0 marks an empty slot. Kernels probe the same table.
+template <typename Symbol> class symbol_classes {
+  static_assert(std::is_unsigned_v<Symbol> && sizeof(Symbol) <= sizeof(std::uint32_t));
+
+public:
+  using element_type = Symbol;
+  using class_type = std::uint32_t;
+
+private:
+  std::vector<std::uint32_t> m_table{0, 0}; // Interleaved symbols and classes
+  unsigned m_count = 1;
+
+  std::size_t mask() const { return m_table.size() / 2 - 1; }
+  std::size_t slot(Symbol symbol) const { return (std::uint32_t{symbol} * 2654435761u) & mask(); }
+
+public:
+  static symbol_classes identity() { return symbol_classes{}; }
+
+  template <typename It> symbol_classes compact(It needles_start, It needles_finish) const {
+    std::vector<Symbol> used;
+    for (; needles_start != needles_finish; ++needles_start) {
+      used.insert(used.end(), needles_start->begin(), needles_start->end());
+    }
+    std::sort(used.begin(), used.end());
+    used.erase(std::unique(used.begin(), used.end()), used.end());
+
+    if (used.size() >= std::numeric_limits<class_type>::max()) throw std::invalid_argument{"Too many symbols"};
+
+    symbol_classes compacted;
+    compacted.m_table.assign(2 * std::bit_ceil(2 * used.size() + 1), 0);
+    for (const auto symbol : used) {
+      auto s = compacted.slot(symbol);
+      while (compacted.m_table[2 * s + 1] != 0) {
+        s = (s + 1) & compacted.mask();
+      }
+      compacted.m_table[2 * s] = symbol;
+      compacted.m_table[2 * s + 1] = compacted.m_count++;
+    }
+
+    return compacted;
+  }
+
+  unsigned operator()(Symbol symbol) const {
+    auto s = slot(symbol);
+    while (m_table[2 * s + 1] != 0 && m_table[2 * s] != symbol) {
+      s = (s + 1) & mask();
+    }
+    return m_table[2 * s + 1];
+  }
+
+  unsigned size() const { return m_count; }
+  const std::vector<std::uint32_t> &table() const { return m_table; }
+  std::size_t table_size() const { return m_table.size() / 2; }
+  std::size_t footprint() const { return m_table.size() * sizeof(std::uint32_t); }
+};
+
+// Token dictionaries contain one needle per line as whitespace separated decimal symbols, empty lines are skipped
+template <typename Symbol> std::vector<std::vector<Symbol>> read_token_dictionary(std::istream &is) {
+  std::vector<std::vector<Symbol>> needles;
+
+  for (std::string line; std::getline(is, line);) {
+    std::istringstream tokens{line};
+    std::vector<Symbol> needle;
+
+    for (unsigned long long value; tokens >> value;) {
+      if (value > std::numeric_limits<Symbol>::max()) {
+        throw std::invalid_argument{"Symbol " + std::to_string(value) + " is out of range"};
+      }
+      needle.push_back(static_cast<Symbol>(value));
+    }
+    if (!tokens.eof()) throw std::invalid_argument{"Malformed token dictionary line: " + line};
+
+    if (!needle.empty()) needles.push_back(std::move(needle));
+  }
+
+  return needles;
+}
+
+template <typename Symbol> std::vector<std::vector<Symbol>> read_token_dictionary(const std::string &path) {
+  std::ifstream is{path};
+  if (!is) throw std::runtime_error{"Can't open dictionary file " + path};
+  return read_token_dictionary<Symbol>(is);
+}
+
+} // namespace matching
@@ -0,0 +1,118 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace matching {
+
+// Independent dictionaries of several tenants, merged into one dictionary so that a single automaton matches all of
+// them in one pass. Every merged needle is owned by a (tenant, needle) pair, and counts of the merged dictionary are
+// split back per tenant. A tenant keeps the id it got when it was added and its needles keep their indices whatever
+// other tenants are added or dropped; ids of dropped tenants are not reused. Needles shared by several tenants are
+// stored once by the automaton and counted for each of them.
+class tenant_dictionaries {
+public:
+  using tenant_id = std::uint32_t;
+
+  struct needle_id {
+    tenant_id tenant;
+    std::uint32_t needle;
+  };
+
+  struct tenant_counts {
+    tenant_id tenant;
+    std::vector<unsigned> counts;
+  };
+
+private:
+  struct tenant {
+    std::string name;
+    std::vector<std::string> needles;
+    bool active = true;
+  };
+
+  std::vector<tenant> m_tenants; // Indexed by id, dropped tenants stay as empty slots
+  std::map<std::string, tenant_id, std::less<>> m_ids;
+
+  std::vector<std::string> m_merged;
+  std::vector<needle_id> m_owners;
+
+  void merge() {
+    m_merged.clear();
+    m_owners.clear();
+    for (tenant_id id = 0; id < m_tenants.size(); ++id) {
+      const auto &t = m_tenants[id];
+      if (!t.active) continue;
+      for (std::uint32_t i = 0; i < t.needles.size(); ++i) {
+        m_merged.push_back(t.needles[i]);
+        m_owners.push_back({id, i});
+      }
+    }
+  }
+
+public:
+  tenant_id add(std::string name, std::vector<std::string> needles) {
+    if (m_ids.contains(name)) throw std::invalid_argument{"Tenant " + name + " already exists"};
+    if (needles.empty()) throw std::invalid_argument{"Dictionary of tenant " + name + " is empty"};
+
+    const auto id = static_cast<tenant_id>(m_tenants.size());
+    m_ids.emplace(name, id);
+    m_tenants.push_back({std::move(name), std::move(needles)});
+    merge();
+    return id;
+  }
+
+  void drop(std::string_view name) {
+    const auto found = m_ids.find(name);
+    if (found == m_ids.end()) throw std::invalid_argument{"Unknown tenant " + std::string{name}};
+
+    auto &t = m_tenants[found->second];
+    t.active = false;
+    t.needles = {};
+    m_ids.erase(found);
+    merge();
+  }
+
+  // Splits the counts of the merged needles into the counts of every active tenant, in order of their ids
+  std::vector<tenant_counts> demultiplex(const std::vector<unsigned> &counts) const {
+    if (counts.size() != m_owners.size()) throw std::invalid_argument{"Counts do not match the merged dictionary"};
+
+    std::vector<tenant_counts> result;
+    for (std::size_t i = 0; i < counts.size(); ++i) {
+      const auto owner = m_owners[i];
+      if (result.empty() || result.back().tenant != owner.tenant) {
+        result.push_back({owner.tenant, std::vector<unsigned>(m_tenants[owner.tenant].needles.size(), 0)});
+      }
+      result.back().counts[owner.needle] = counts[i];
+    }
+    return result;
+  }
+
+  // Needles of all active tenants in order of their ids, the dictionary of the merged automaton
+  const std::vector<std::string> &merged() const { return m_merged; }
+  needle_id owner(std::size_t merged_index) const { return m_owners[merged_index]; }
+
+  const std::string &name(tenant_id id) const { return m_tenants[id].name; }
+  const std::vector<std::string> &needles(tenant_id id) const { return m_tenants[id].needles; }
+  std::size_t size() const { return m_ids.size(); }
+  bool empty() const { return m_ids.empty(); }
+};
+
+} // namespace matching
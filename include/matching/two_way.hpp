@@ -0,0 +1,151 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "alphabet.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace matching {
+
+// Single needle prepared for the Two-Way algorithm of Crochemore and Perrin. The needle is split at a critical
+// position into a left and a right part; the right part is compared left to right and a mismatch at i shifts by
+// i - critical + 1, the left part is compared right to left and a match or mismatch there shifts by the period. For
+// periodic needles the prefix that is known to match after such a shift is remembered and not compared again. Apart
+// from the needle itself this takes constant memory, and a scan is linear in the haystack.
+class two_way_needle {
+  byte_classes m_classes;
+  std::string m_needle; // Translated to byte classes
+  std::size_t m_critical = 0, m_period = 1;
+  bool m_periodic = false;
+
+  // Maximal suffix of the needle for one of the two orders of the symbols; returns its start and sets its period.
+  // Indices start one below zero, which unsigned wrap-around makes the same as in the reference formulation.
+  template <typename Less> std::size_t maximal_suffix(std::size_t &period, Less less) const {
+    std::size_t max_suffix = static_cast<std::size_t>(-1), j = 0, k = 1;
+    period = 1;
+
+    while (j + k < m_needle.size()) {
+      const auto a = static_cast<unsigned char>(m_needle[j + k]);
+      const auto b = static_cast<unsigned char>(m_needle[max_suffix + k]);
+      if (less(a, b)) {
+        j += k;
+        k = 1;
+        period = j - max_suffix;
+      } else if (a == b) {
+        if (k != period) {
+          ++k;
+        } else {
+          j += period;
+          k = 1;
+        }
+      } else {
+        max_suffix = j++;
+        k = period = 1;
+      }
+    }
+
+    return max_suffix + 1;
+  }
+
+public:
+  two_way_needle(std::string_view needle, const byte_classes &classes = byte_classes::identity())
+      : m_classes{classes}, m_needle(needle.size(), '\0') {
+    if (needle.empty()) throw std::invalid_argument{"Needle is empty"};
+    std::transform(needle.begin(), needle.end(), m_needle.begin(), [&](char c) {
+      return static_cast<char>(m_classes(c));
+    });
+
+    // The later of the two maximal suffixes gives a critical factorization
+    std::size_t period = 1, reverse_period = 1;
+    const auto suffix = maximal_suffix(period, std::less<>{});
+    const auto reverse_suffix = maximal_suffix(reverse_period, std::greater<>{});
+    m_critical = std::max(suffix, reverse_suffix);
+    m_period = (reverse_suffix >= suffix ? reverse_period : period);
+
+    // The period is the needle's own only if the left part occurs again one period later
+    m_periodic = std::equal(m_needle.begin(), m_needle.begin() + m_critical, m_needle.begin() + m_period);
+    if (!m_periodic) m_period = std::max(m_critical, m_needle.size() - m_critical) + 1;
+  }
+
+  // Host reference of the kernel, without the candidate filter
+  std::vector<unsigned> count(std::string_view haystack) const {
+    const auto m = m_needle.size();
+    std::vector<unsigned> counts(1, 0);
+    if (haystack.size() < m) return counts;
+
+    const auto at = [&](std::size_t i) { return static_cast<char>(m_classes(haystack[i])); };
+    for (std::size_t j = 0, memory = 0; j <= haystack.size() - m;) {
+      auto i = std::max(m_critical, memory);
+      while (i < m && m_needle[i] == at(i + j)) {
+        ++i;
+      }
+      if (i < m) {
+        j += i - m_critical + 1;
+        memory = 0;
+        continue;
+      }
+
+      auto left = static_cast<std::ptrdiff_t>(m_critical) - 1;
+      while (left >= static_cast<std::ptrdiff_t>(memory) && m_needle[left] == at(left + j)) {
+        --left;
+      }
+      if (left < static_cast<std::ptrdiff_t>(memory)) ++counts[0];
+
+      j += m_period;
+      memory = (m_periodic ? m - m_period : 0);
+    }
+
+    return counts;
+  }
+
+  // Two needle positions whose symbols are the rarest in `sample`, preferably different ones. A position can only
+  // hold a match when the haystack has both symbols at these offsets.
+  std::array<std::uint32_t, 2> rare_pair(std::string_view sample) const {
+    std::array<std::size_t, byte_classes::max_classes> frequency{};
+    for (const auto c : sample) {
+      ++frequency[m_classes(c)];
+    }
+
+    const auto rarity = [&](std::size_t i) { return frequency[static_cast<unsigned char>(m_needle[i])]; };
+    std::size_t first = 0;
+    for (std::size_t i = 1; i < m_needle.size(); ++i) {
+      if (rarity(i) < rarity(first)) first = i;
+    }
+
+    std::size_t second = (first == 0 ? m_needle.size() - 1 : 0);
+    for (std::size_t i = 0; i < m_needle.size(); ++i) {
+      if (i == first) continue;
+      const bool differs = (m_needle[i] != m_needle[first]), second_differs = (m_needle[second] != m_needle[first]);
+      if (differs > second_differs || (differs == second_differs && rarity(i) < rarity(second))) second = i;
+    }
+
+    return {static_cast<std::uint32_t>(first), static_cast<std::uint32_t>(second)};
+  }
+
+  const byte_classes &classes() const { return m_classes; }
+  const std::string &needle() const { return m_needle; }
+  std::size_t critical() const { return m_critical; }
+  std::size_t period() const { return m_period; }
+  bool periodic() const { return m_periodic; }
+  std::size_t num_needles() const { return 1; }
+  std::size_t max_needle_length() const { return m_needle.size(); }
+};
+
+} // namespace matching
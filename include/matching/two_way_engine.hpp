@@ -0,0 +1,78 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "device.hpp"
+#include "engine.hpp"
+#include "two_way.hpp"
+
+#include "kernelhpp/two_way_kernel.hpp"
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace matching {
+
+// Single needle of any length. Work-items scan ranges of alignments with the Two-Way algorithm behind a filter on the
+// needle's two rarest symbols, which are picked per haystack from a sample of it. Device memory is the needle and the
+// byte class table.
+class two_way_engine : public engine {
+  static constexpr std::size_t sample_size = 1 << 16;
+
+  const device_context &m_ctx;
+  two_way_needle m_needle;
+  unsigned m_chunk_size;
+
+  cl::Program m_program;
+  cl::Kernel m_kernel;
+  device_array m_classes, m_symbols;
+
+public:
+  two_way_engine(const device_context &ctx, two_way_needle needle, unsigned chunk_size = default_chunk_size)
+      : m_ctx{ctx}, m_needle{std::move(needle)}, m_chunk_size{chunk_size},
+        m_program{m_ctx.build_program(two_way_kernel::source())},
+        m_kernel{m_program, two_way_kernel::entry().c_str()}, m_classes{m_ctx, m_needle.classes().table()},
+        m_symbols{m_ctx, m_needle.needle()} {}
+
+  match_result match(std::string_view haystack) override {
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+    const auto length = m_needle.max_needle_length();
+    if (haystack.size() < length) return {std::vector<unsigned>(1, 0), {}};
+
+    const auto alignments = haystack.size() - length + 1;
+    const auto num_chunks = (alignments + m_chunk_size - 1) / m_chunk_size;
+    const auto haystack_size = haystack_length(haystack.size(), num_chunks, m_chunk_size);
+    const auto [rare0, rare1] = m_needle.rare_pair(haystack.substr(0, sample_size));
+
+    const auto [counts, event] = count_matches(
+        m_ctx, haystack, 1,
+        [&](const auto &deps, const auto &haystack_arg, const auto &counts_arg) {
+          return launch_kernel(
+              m_ctx.queue(), m_kernel, deps, cl::NDRange{num_chunks}, haystack_arg,
+              haystack_size, m_chunk_size, m_classes, m_symbols,
+              static_cast<cl_uint>(length), static_cast<cl_uint>(m_needle.critical()),
+              static_cast<cl_uint>(m_needle.period()), static_cast<cl_uint>(m_needle.periodic()), rare0, rare1,
+              counts_arg
+          );
+        }
+    );
+
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+    return {counts, {to_millis(event_duration(event)), to_millis(wall_end - wall_start)}};
+  }
+
+  std::string name() const override { return "two-way"; }
+  std::size_t footprint() const override { return m_needle.max_needle_length() + byte_classes::max_classes; }
+};
+
+} // namespace matching
@@ -0,0 +1,94 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "alphabet.hpp"
+#include "pattern.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace matching {
+
+// Needles of fixed length with don't-care positions, stored as byte classes. A position with a zero mask matches any
+// byte.
+class masked_needles {
+  byte_classes m_classes;
+  std::vector<std::uint8_t> m_symbols, m_mask;
+  std::vector<std::uint32_t> m_offsets{0}; // Needle i takes [m_offsets[i], m_offsets[i + 1])
+  std::size_t m_max_length = 0;
+
+public:
+  // Patterns may only contain single bytes, `?` and fixed repeats of them (e.g. `\x4d\x5a?{58}\x50\x45`). Classes
+  // of `classes` (e.g. case-insensitive letters) match each other.
+  masked_needles(const std::vector<std::string> &patterns, const byte_classes &classes = byte_classes::identity())
+      : m_classes{classes} {
+    if (patterns.empty()) throw std::invalid_argument{"Dictionary is empty"};
+
+    for (const auto &pattern : patterns) {
+      for (const auto &element : parse_pattern(pattern)) {
+        const bool any = element.bytes.all();
+        if (!any && element.bytes.count() != 1) {
+          throw std::invalid_argument{"Pattern \"" + pattern + "\": byte sets other than ? can't be masked"};
+        }
+        if (element.min != element.max) {
+          throw std::invalid_argument{"Pattern \"" + pattern + "\": masked needles need fixed repeats"};
+        }
+
+        unsigned byte = 0;
+        while (!any && !element.bytes[byte]) {
+          ++byte;
+        }
+        m_symbols.insert(m_symbols.end(), element.max, static_cast<std::uint8_t>(m_classes(static_cast<char>(byte))));
+        m_mask.insert(m_mask.end(), element.max, static_cast<std::uint8_t>(!any));
+      }
+
+      m_offsets.push_back(static_cast<std::uint32_t>(m_symbols.size()));
+      m_max_length = std::max<std::size_t>(m_max_length, m_offsets.back() - m_offsets[m_offsets.size() - 2]);
+    }
+  }
+
+  bool matches_at(std::size_t needle, std::string_view haystack, std::size_t position) const {
+    const auto first = m_offsets[needle], length = m_offsets[needle + 1] - first;
+    if (position + length > haystack.size()) return false;
+
+    for (std::size_t j = 0; j < length; ++j) {
+      if (m_mask[first + j] && m_classes(haystack[position + j]) != m_symbols[first + j]) return false;
+    }
+    return true;
+  }
+
+  // Direct comparison at every position, the host reference of the device engines
+  std::vector<unsigned> count(std::string_view haystack) const {
+    std::vector<unsigned> counts(num_needles(), 0);
+    for (std::size_t position = 0; position < haystack.size(); ++position) {
+      for (std::size_t needle = 0; needle < num_needles(); ++needle) {
+        counts[needle] += matches_at(needle, haystack, position);
+      }
+    }
+    return counts;
+  }
+
+  const byte_classes &classes() const { return m_classes; }
+  const std::vector<std::uint8_t> &symbols() const { return m_symbols; }
+  const std::vector<std::uint8_t> &mask() const { return m_mask; }
+  const std::vector<std::uint32_t> &offsets() const { return m_offsets; }
+  std::size_t length(std::size_t needle) const { return m_offsets[needle + 1] - m_offsets[needle]; }
+  std::size_t num_needles() const { return m_offsets.size() - 1; }
+  std::size_t max_needle_length() const { return m_max_length; }
+};
+
+} // namespace matching
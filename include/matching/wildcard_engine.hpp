@@ -0,0 +1,213 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "device.hpp"
+#include "engine.hpp"
+#include "wildcard.hpp"
+
+#include "kernelhpp/wildcard_kernel.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace matching {
+
+enum class wildcard_method {
+  compare,
+  fft
+};
+
+inline wildcard_method parse_wildcard_method(const std::string &name) {
+  if (name == "compare") return wildcard_method::compare;
+  if (name == "fft") return wildcard_method::fft;
+  throw std::invalid_argument{"Unknown wildcard method " + name};
+}
+
+inline std::string to_string(wildcard_method method) { return (method == wildcard_method::fft ? "fft" : "compare"); }
+
+// Masked needles on the device. `compare` checks every needle at every position directly, `fft` scores all positions
+// at once with the sum of squared differences computed by FFT convolution (see kernels/wildcard.cl), which pays off
+// for long needles. The haystack is cut into overlapping blocks of the transform size, and as many blocks as fit into
+// `max_batch_bytes` of work buffers are transformed in one batch. Needle spectra are computed once, on construction.
+class wildcard_engine : public engine {
+  static constexpr std::size_t min_fft_size = 1024;
+  static constexpr std::size_t max_batch_bytes = std::size_t{192} << 20;
+  static constexpr float tolerance_factor = 4e-5f;
+
+  const device_context &m_ctx;
+  masked_needles m_needles;
+  wildcard_method m_method;
+
+  cl::Program m_program;
+  cl::Kernel m_compare, m_load_text, m_load_needle, m_fft_pass, m_multiply, m_score;
+  device_array m_classes, m_symbols, m_mask, m_offsets;
+
+  std::size_t m_fft_size = 0, m_step = 0, m_batch = 0;
+  std::vector<cl::Buffer> m_spectra;
+  std::vector<float> m_weights, m_tolerances;
+
+  // Passes of a batch of transforms over `data` with `scratch` as the second buffer. Returns the buffer holding the
+  // result.
+  const cl::Buffer &transform(
+      const cl::Buffer &data, const cl::Buffer &scratch, std::size_t blocks, float sign, std::vector<cl::Event> &events
+  ) {
+    const cl::Buffer *in = &data, *out = &scratch;
+    const auto n = static_cast<cl_uint>(m_fft_size);
+
+    for (cl_uint span = 1; span < n; span <<= 1) {
+      events.push_back(launch_kernel(
+          m_ctx.queue(), m_fft_pass, {}, cl::NDRange{m_fft_size / 2, blocks}, *in, *out, n, span, sign
+      ));
+      std::swap(in, out);
+    }
+    return *in;
+  }
+
+  void prepare_fft() {
+    const auto max_length = m_needles.max_needle_length();
+    const auto max_alloc = m_ctx.device().getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+
+    m_fft_size = std::max(min_fft_size, std::bit_ceil(4 * max_length));
+    m_step = m_fft_size - max_length + 1;
+    const auto block_bytes = m_fft_size * sizeof(cl_float2);
+    m_batch = std::max<std::size_t>(1, std::min(max_batch_bytes / (3 * block_bytes), max_alloc / block_bytes));
+    if (block_bytes > max_alloc) throw std::invalid_argument{"Needles are too long for an FFT on this device"};
+
+    // Rounding grows with the transform size and the magnitude of the squared symbols
+    const auto max_symbol = static_cast<float>(m_needles.classes().size() - 1);
+    const auto log_size = static_cast<float>(std::bit_width(m_fft_size) - 1);
+
+    const auto n = static_cast<cl_uint>(m_fft_size);
+    auto scratch = m_ctx.pool().acquire(block_bytes);
+    std::vector<cl::Event> events;
+
+    for (std::size_t i = 0; i < m_needles.num_needles(); ++i) {
+      const auto first = m_needles.offsets()[i];
+      const auto length = static_cast<cl_uint>(m_needles.length(i));
+
+      float weight = 0;
+      for (std::size_t j = first; j < first + length; ++j) {
+        weight += static_cast<float>(m_needles.mask()[j]) * m_needles.symbols()[j] * m_needles.symbols()[j];
+      }
+      m_weights.push_back(weight);
+      m_tolerances.push_back(0.5f + tolerance_factor * log_size * length * max_symbol * max_symbol);
+
+      auto &spectrum = m_spectra.emplace_back(m_ctx.context(), CL_MEM_READ_WRITE, block_bytes);
+      launch_kernel(
+          m_ctx.queue(), m_load_needle, {}, cl::NDRange{m_fft_size}, m_symbols, m_mask, first, length, n, spectrum
+      );
+      const auto &result = transform(spectrum, scratch.buffer(), 1, -1.0f, events);
+      if (&result != &spectrum) m_ctx.queue().enqueueCopyBuffer(result, spectrum, 0, 0, block_bytes);
+    }
+
+    m_ctx.queue().finish();
+  }
+
+  // Batches of blocks: forward transform of the text, then per needle a product of spectra, a backward transform and
+  // the scores. The queue is in order, so only the first kernel waits for `deps`.
+  template <typename Haystack, typename Counts>
+  void launch_fft(
+      const std::vector<cl::Event> &deps, const Haystack &haystack, cl_uint haystack_size, const Counts &counts,
+      std::vector<cl::Event> &events
+  ) {
+    const auto n = static_cast<cl_uint>(m_fft_size), step = static_cast<cl_uint>(m_step);
+    const auto num_blocks = (haystack_size + m_step - 1) / m_step;
+    const auto batch_bytes = std::min(m_batch, num_blocks) * m_fft_size * sizeof(cl_float2);
+    auto text = m_ctx.pool().acquire(batch_bytes), work = m_ctx.pool().acquire(batch_bytes),
+         scratch = m_ctx.pool().acquire(batch_bytes);
+
+    for (std::size_t block = 0; block < num_blocks; block += m_batch) {
+      const auto blocks = std::min(m_batch, num_blocks - block);
+      const auto start = static_cast<cl_uint>(block * m_step);
+
+      events.push_back(launch_kernel(
+          m_ctx.queue(), m_load_text, (events.empty() ? deps : std::vector<cl::Event>{}),
+          cl::NDRange{m_fft_size, blocks}, haystack, haystack_size, m_classes, start, step, n, text.buffer()
+      ));
+      const auto &spectrum = transform(text.buffer(), scratch.buffer(), blocks, -1.0f, events);
+      const auto &spare = (&spectrum == &text.buffer() ? scratch.buffer() : text.buffer());
+
+      for (cl_uint i = 0; i < m_needles.num_needles(); ++i) {
+        events.push_back(launch_kernel(
+            m_ctx.queue(), m_multiply, {}, cl::NDRange{m_fft_size, blocks}, spectrum, m_spectra[i], n, work.buffer()
+        ));
+        const auto &correlation = transform(work.buffer(), spare, blocks, 1.0f, events);
+        events.push_back(launch_kernel(
+            m_ctx.queue(), m_score, {}, cl::NDRange{m_step, blocks}, correlation, haystack, haystack_size, m_classes,
+            m_symbols, m_mask, m_needles.offsets()[i], static_cast<cl_uint>(m_needles.length(i)), m_weights[i],
+            m_tolerances[i], start, step, n, counts, i
+        ));
+      }
+    }
+  }
+
+public:
+  wildcard_engine(const device_context &ctx, masked_needles needles, wildcard_method method = wildcard_method::fft)
+      : m_ctx{ctx}, m_needles{std::move(needles)}, m_method{method},
+        m_program{m_ctx.build_program(wildcard_kernel::source())},
+        m_compare{m_program, wildcard_kernel::entry().c_str()}, m_load_text{m_program, "load_text"},
+        m_load_needle{m_program, "load_needle"}, m_fft_pass{m_program, "fft_pass"},
+        m_multiply{m_program, "multiply"}, m_score{m_program, "score"},
+        m_classes{m_ctx, m_needles.classes().table()}, m_symbols{m_ctx, m_needles.symbols()},
+        m_mask{m_ctx, m_needles.mask()}, m_offsets{m_ctx, m_needles.offsets()} {
+    if (m_method == wildcard_method::fft) prepare_fft();
+  }
+
+  match_result match(std::string_view haystack) override {
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+    const auto num_needles = m_needles.num_needles();
+    if (haystack.empty()) return {std::vector<unsigned>(num_needles, 0), {}};
+
+    const auto haystack_size = haystack_length(haystack.size());
+    std::vector<cl::Event> events;
+
+    const auto [counts, last] = count_matches(
+        m_ctx, haystack, num_needles,
+        [&](const auto &deps, const auto &haystack_arg, const auto &counts_arg) {
+          if (m_method == wildcard_method::fft) {
+            launch_fft(deps, haystack_arg, haystack_size, counts_arg, events);
+            return events.back();
+          }
+
+          events.push_back(launch_kernel(
+              m_ctx.queue(), m_compare, deps, cl::NDRange{haystack.size()}, haystack_arg, haystack_size, m_classes,
+              m_symbols, m_mask, m_offsets, static_cast<cl_uint>(num_needles), counts_arg
+          ));
+          return events.back();
+        }
+    );
+
+    std::chrono::nanoseconds pure{0};
+    for (const auto &event : events) {
+      pure += event_duration(event);
+    }
+
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+    return {counts, {to_millis(pure), to_millis(wall_end - wall_start)}};
+  }
+
+  std::string name() const override { return to_string(m_method); }
+  std::size_t footprint() const override {
+    return m_needles.symbols().size() * 2 + m_needles.offsets().size() * sizeof(cl_uint) +
+           m_spectra.size() * m_fft_size * sizeof(cl_float2) + byte_classes::max_classes;
+  }
+  std::size_t fft_size() const { return m_fft_size; }
+};
+
+} // namespace matching
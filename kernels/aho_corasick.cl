@@ -0,0 +1,159 @@
+// @kernel({"name": "aho_corasick_kernel", "entry": "match"})
+// @signature(["cl::Buffer", "cl_uint", "cl_uint", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer"])
+// @macros([{"type": "unsigned", "name": "NUM_CLASSES"}, {"type": "unsigned", "name": "OVERLAP"}, {"type": "unsigned", "name": "SUBGROUPS"}, {"type": "unsigned", "name": "COUNTING"}, {"type": "unsigned", "name": "TABLE_SIZE"}, {"type": "unsigned", "name": "PACK_BITS"}])
+
+#define NO_NEEDLE 0xffffffffu
+
+// Where hits are added up, see matching::counting
+#define COUNT_GLOBAL 0
+#define COUNT_LOCAL 1
+#define COUNT_LOCAL_HASH 2
+
+#define EMPTY_KEY 0xffffffffu
+#define MAX_PROBES 8
+
+// The local table holds a counter per needle, or TABLE_SIZE hash keys followed by their counters
+#if COUNTING == COUNT_LOCAL_HASH
+#define TABLE_WORDS (2 * TABLE_SIZE)
+#else
+#define TABLE_WORDS TABLE_SIZE
+#endif
+
+void add_hits(__local uint *table, __global uint *counts, uint needle, uint n) {
+#if COUNTING == COUNT_LOCAL
+  atomic_add(table + needle, n);
+#elif COUNTING == COUNT_LOCAL_HASH
+  uint slot = (needle * 2654435761u) & (TABLE_SIZE - 1);
+  for (uint probe = 0; probe < MAX_PROBES; ++probe) {
+    const uint key = atomic_cmpxchg(table + slot, EMPTY_KEY, needle);
+    if (key == EMPTY_KEY || key == needle) {
+      atomic_add(table + TABLE_SIZE + slot, n);
+      return;
+    }
+    slot = (slot + 1) & (TABLE_SIZE - 1);
+  }
+  atomic_add(counts + needle, n);
+#else
+  atomic_add(counts + needle, n);
+#endif
+}
+
+#if PACK_BITS
+// Packed haystacks hold 32 / PACK_BITS symbol codes per 32-bit word (see matching::packing) and `classes` maps codes
+// to classes. A word is loaded once and its codes are shifted out of a register.
+#define CODES_PER_WORD (32 / PACK_BITS)
+
+uint packed_class(__global const uint *words, __constant uchar *classes, uint i, uint *word) {
+  const uint shift = (i % CODES_PER_WORD) * PACK_BITS;
+  if (shift == 0) *word = words[i / CODES_PER_WORD];
+  return classes[(*word >> shift) & ((1u << PACK_BITS) - 1)];
+}
+
+#define CLASS_AT(i) packed_class((__global const uint *)haystack, classes, (i), &word)
+#else
+#define CLASS_AT(i) classes[haystack[i]]
+#endif
+
+#if SUBGROUPS
+#ifdef cl_khr_subgroups
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+#endif
+
+#define MAX_PENDING 8
+#define FLUSH_INTERVAL 64
+
+// Counts the pending hits of the whole sub-group with one addition per distinct needle instead of one per hit. In
+// every round the needle on top of the lowest active lane is broadcast, the lanes holding it on top drop it, and the
+// leader adds them all. Must be reached by every work-item of the sub-group.
+void flush_hits(uint *pending, uint *num_pending, __local uint *table, __global uint *counts) {
+  const uint lane = get_sub_group_local_id();
+
+  while (sub_group_any(*num_pending != 0)) {
+    const uint top = (*num_pending != 0 ? pending[*num_pending - 1] : NO_NEEDLE);
+    const uint leader = sub_group_reduce_min(top != NO_NEEDLE ? lane : 0xffffffffu);
+    const uint needle = sub_group_broadcast(top, leader);
+    const uint same = (top == needle);
+    const uint total = sub_group_reduce_add(same);
+
+    if (lane == leader) add_hits(table, counts, needle, total);
+    if (same) --*num_pending;
+  }
+}
+#endif
+
+// Every work-item scans its own chunk of the haystack. To find matches that start in the previous chunk the scan is
+// warmed up on OVERLAP preceding bytes (the longest needle minus one) and only matches ending inside the chunk are
+// counted. Bytes are translated to their equivalence classes on the fly. Work-items past the end keep an empty chunk
+// instead of returning, since sub-group flushes and the local table merge are reached by all of them. Sizes and
+// offsets count symbols, which are bytes unless the haystack is packed.
+__kernel void match(__global const uchar *haystack, uint haystack_size, uint chunk_size, __constant uchar *classes,
+                    __global const uint *transitions, __global const uint *needle_of,
+                    __global const uint *dict_link, __global uint *counts) {
+#if COUNTING != COUNT_GLOBAL
+  __local uint table[TABLE_WORDS];
+  const uint lid = get_local_id(0), group_size = get_local_size(0);
+
+  for (uint j = lid; j < TABLE_WORDS; j += group_size) {
+    table[j] = (COUNTING == COUNT_LOCAL_HASH && j < TABLE_SIZE ? EMPTY_KEY : 0);
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+#else
+  __local uint *table = 0;
+#endif
+
+  const uint chunk_start = get_global_id(0) * chunk_size;
+  const bool active = (chunk_start < haystack_size);
+  const uint chunk_end = (active ? min(chunk_start + chunk_size, haystack_size) : chunk_start);
+  uint i = (!active ? chunk_start : chunk_start > OVERLAP ? chunk_start - OVERLAP : 0);
+  uint state = 0;
+#if PACK_BITS
+  uint word = (i < haystack_size ? ((__global const uint *)haystack)[i / CODES_PER_WORD] : 0);
+#endif
+
+  for (; i < chunk_start; ++i) {
+    state = transitions[state * NUM_CLASSES + CLASS_AT(i)];
+  }
+
+#if SUBGROUPS
+  // Hits are buffered per work-item and flushed at the same steps in every work-item. A full buffer falls back to
+  // direct additions until the next flush.
+  uint pending[MAX_PENDING];
+  uint num_pending = 0;
+
+  for (uint step = 0; step < chunk_size; step += FLUSH_INTERVAL) {
+    const uint block_end = chunk_start + min(step + FLUSH_INTERVAL, chunk_end - chunk_start);
+
+    for (; i < block_end; ++i) {
+      state = transitions[state * NUM_CLASSES + CLASS_AT(i)];
+      for (uint o = (needle_of[state] != NO_NEEDLE ? state : dict_link[state]); o != 0; o = dict_link[o]) {
+        if (num_pending < MAX_PENDING) {
+          pending[num_pending++] = needle_of[o];
+        } else {
+          add_hits(table, counts, needle_of[o], 1);
+        }
+      }
+    }
+
+    flush_hits(pending, &num_pending, table, counts);
+  }
+#else
+  for (; i < chunk_end; ++i) {
+    state = transitions[state * NUM_CLASSES + CLASS_AT(i)];
+    for (uint o = (needle_of[state] != NO_NEEDLE ? state : dict_link[state]); o != 0; o = dict_link[o]) {
+      add_hits(table, counts, needle_of[o], 1);
+    }
+  }
+#endif
+
+#if COUNTING != COUNT_GLOBAL
+  // The group's table is merged with one global atomic per needle it has seen
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for (uint j = lid; j < TABLE_SIZE; j += group_size) {
+#if COUNTING == COUNT_LOCAL_HASH
+    if (table[j] != EMPTY_KEY) atomic_add(counts + table[j], table[TABLE_SIZE + j]);
+#else
+    if (table[j] != 0) atomic_add(counts + j, table[j]);
+#endif
+  }
+#endif
+}
@@ -0,0 +1,79 @@
+// @kernel({"name": "compressed_ac_kernel", "entry": "match"})
+// @signature(["cl::Buffer", "cl_uint", "cl_uint", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer"])
+// @macros([{"type": "unsigned", "name": "NUM_CLASSES"}, {"type": "unsigned", "name": "NUM_DENSE"}, {"type": "unsigned", "name": "OVERLAP"}, {"type": "unsigned", "name": "SYMBOL_BYTES"}, {"type": "unsigned", "name": "CLASS_TABLE_SIZE"}])
+
+#define NO_NEEDLE 0xffffffffu
+
+// Haystack elements are bytes, translated by a table of byte classes, or 16 and 32-bit symbols, translated by the
+// (symbol, class) hash table of matching::symbol_classes with CLASS_TABLE_SIZE slots
+#if SYMBOL_BYTES == 1
+typedef uchar symbol_t;
+typedef uchar class_t;
+#define CLASS_TABLE __constant uchar *
+#else
+#if SYMBOL_BYTES == 2
+typedef ushort symbol_t;
+#else
+typedef uint symbol_t;
+#endif
+typedef uint class_t;
+#define CLASS_TABLE __global const uint2 *
+#endif
+
+uint class_of(symbol_t symbol, CLASS_TABLE classes) {
+#if SYMBOL_BYTES == 1
+  return classes[symbol];
+#else
+  uint slot = ((uint)symbol * 2654435761u) & (CLASS_TABLE_SIZE - 1);
+  while (classes[slot].y != 0 && classes[slot].x != symbol) {
+    slot = (slot + 1) & (CLASS_TABLE_SIZE - 1);
+  }
+  return classes[slot].y;
+#endif
+}
+
+// Same traversal as compressed_automaton::next_class. States below NUM_DENSE have complete rows, the rest store
+// sorted sparse edges and defer to the failure state when the symbol is missing.
+uint next_state(uint state, uint symbol, __global const uint *dense, __global const uint *edge_offsets,
+                __global const class_t *edge_symbols, __global const uint *edge_targets,
+                __global const uint *failure) {
+  while (state >= NUM_DENSE) {
+    const uint finish = edge_offsets[state + 1];
+    uint lo = edge_offsets[state], hi = finish;
+
+    while (lo < hi) {
+      const uint mid = (lo + hi) / 2;
+      if (edge_symbols[mid] < symbol) lo = mid + 1;
+      else hi = mid;
+    }
+
+    if (lo < finish && edge_symbols[lo] == symbol) return edge_targets[lo];
+    state = failure[state];
+  }
+
+  return dense[state * NUM_CLASSES + symbol];
+}
+
+// Sizes and offsets count haystack elements
+__kernel void match(__global const symbol_t *haystack, uint haystack_size, uint chunk_size, CLASS_TABLE classes,
+                    __global const uint *dense, __global const uint *edge_offsets, __global const class_t *edge_symbols,
+                    __global const uint *edge_targets, __global const uint *failure, __global const uint *needle_of,
+                    __global const uint *dict_link, __global uint *counts) {
+  const uint chunk_start = get_global_id(0) * chunk_size;
+  if (chunk_start >= haystack_size) return;
+
+  const uint chunk_end = min(chunk_start + chunk_size, haystack_size);
+  uint i = (chunk_start > OVERLAP ? chunk_start - OVERLAP : 0);
+  uint state = 0;
+
+  for (; i < chunk_start; ++i) {
+    state = next_state(state, class_of(haystack[i], classes), dense, edge_offsets, edge_symbols, edge_targets, failure);
+  }
+
+  for (; i < chunk_end; ++i) {
+    state = next_state(state, class_of(haystack[i], classes), dense, edge_offsets, edge_symbols, edge_targets, failure);
+    for (uint o = (needle_of[state] != NO_NEEDLE ? state : dict_link[state]); o != 0; o = dict_link[o]) {
+      atomic_inc(counts + needle_of[o]);
+    }
+  }
+}
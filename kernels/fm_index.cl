@@ -0,0 +1,42 @@
+// @kernel({"name": "fm_index_kernel", "entry": "count_needles"})
+// @signature(["cl::Buffer", "cl::Buffer", "cl_uint", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl_uint", "cl_uint", "cl::Buffer"])
+// @macros([{"type": "unsigned", "name": "BLOCK_SIZE"}, {"type": "unsigned", "name": "SIGMA"}])
+
+#define NO_SYMBOL 0xffffffffu
+
+// Occurrences of byte c (symbol s) in bwt[0, row): the checkpoint before the row's block plus a scan of the block.
+// The '$' row holds a zero byte that is not a symbol and is skipped.
+uint occ(__global const uchar *bwt, __global const uint *checkpoints, uint dollar, uint s, uchar c, uint row) {
+  const uint block = row / BLOCK_SIZE;
+  uint count = checkpoints[block * SIGMA + s];
+
+  for (uint r = block * BLOCK_SIZE; r < row; ++r) {
+    count += (bwt[r] == c && r != dollar);
+  }
+
+  return count;
+}
+
+// Backward search of one needle per work-item over the FM-index. Needles are concatenated, needle i spanning
+// [offsets[i], offsets[i + 1]).
+__kernel void count_needles(__global const uchar *needles, __global const uint *offsets, uint num_needles,
+                            __global const uchar *bwt, __global const uint *checkpoints, __global const uint *first,
+                            __global const uint *symbol_of, uint rows, uint dollar, __global uint *counts) {
+  const uint id = get_global_id(0);
+  if (id >= num_needles) return;
+
+  uint sp = 0, ep = rows;
+  for (uint i = offsets[id + 1]; i > offsets[id] && sp < ep; --i) {
+    const uchar c = needles[i - 1];
+    const uint s = symbol_of[c];
+    if (s == NO_SYMBOL) {
+      ep = sp;
+      break;
+    }
+
+    sp = first[s] + occ(bwt, checkpoints, dollar, s, c, sp);
+    ep = first[s] + occ(bwt, checkpoints, dollar, s, c, ep);
+  }
+
+  counts[id] = (sp < ep ? ep - sp : 0);
+}
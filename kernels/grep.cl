@@ -0,0 +1,143 @@
+// @kernel({"name": "grep_kernel", "entry": "scan_lines"})
+// @signature(["cl::Buffer", "cl_uint", "cl_uint", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer"])
+// @macros([{"type": "unsigned", "name": "NUM_CLASSES"}, {"type": "unsigned", "name": "OVERLAP"}, {"type": "unsigned", "name": "SCAN_WIDTH"}, {"type": "unsigned", "name": "SUBGROUPS"}])
+
+#define NO_NEEDLE 0xffffffffu
+#define WORD_BITS 32
+
+#if SUBGROUPS && defined(cl_khr_subgroups)
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+#endif
+
+// Chunked Aho-Corasick scan that builds the line index on the way. Chunks are a multiple of WORD_BITS bytes, so every
+// work-item writes whole words of the newline bitmap and of the match bitmap. A match bit marks the end of the first
+// match on each line of the chunk, a line crossing a chunk boundary may be marked by both chunks. The number of
+// newlines and of marked lines of every chunk are scanned by prefix_sum afterwards.
+__kernel void scan_lines(__global const uchar *haystack, uint haystack_size, uint chunk_size,
+                         __constant uchar *classes, __global const uint *transitions, __global const uint *needle_of,
+                         __global const uint *dict_link, __global uint *newline_bits, __global uint *match_bits,
+                         __global uint *chunk_lines, __global uint *chunk_hits) {
+  const uint chunk = get_global_id(0);
+  const uint chunk_start = chunk * chunk_size;
+  if (chunk_start >= haystack_size) return;
+
+  const uint chunk_end = min(chunk_start + chunk_size, haystack_size);
+  uint i = (chunk_start > OVERLAP ? chunk_start - OVERLAP : 0);
+  uint state = 0;
+
+  for (; i < chunk_start; ++i) {
+    state = transitions[state * NUM_CLASSES + classes[haystack[i]]];
+  }
+
+  uint lines = 0, hits = 0, marked = 0xffffffffu;
+  uint newline_word = 0, match_word = 0;
+
+  for (; i < chunk_end; ++i) {
+    const uchar symbol = haystack[i];
+    const uint bit = 1u << (i % WORD_BITS);
+    state = transitions[state * NUM_CLASSES + classes[symbol]];
+
+    // A match ending on the newline itself belongs to the line the newline terminates
+    const bool matched = (needle_of[state] != NO_NEEDLE || dict_link[state] != 0);
+    if (matched && marked != lines) {
+      match_word |= bit;
+      marked = lines;
+      ++hits;
+    }
+
+    if (symbol == '\n') {
+      newline_word |= bit;
+      ++lines;
+    }
+
+    if (i % WORD_BITS == WORD_BITS - 1 || i + 1 == chunk_end) {
+      newline_bits[i / WORD_BITS] = newline_word;
+      match_bits[i / WORD_BITS] = match_word;
+      newline_word = match_word = 0;
+    }
+  }
+
+  chunk_lines[chunk] = lines;
+  chunk_hits[chunk] = hits;
+}
+
+// Exclusive prefix sum of n values by a single work-group, out[n] receives the total. Every work-item sums a
+// contiguous segment, the segment sums are scanned in local memory and each work-item then writes its segment.
+__kernel void prefix_sum(__global const uint *in, __global uint *out, uint n) {
+  __local uint sums[SCAN_WIDTH];
+
+  const uint id = get_local_id(0), width = get_local_size(0);
+  const uint segment = (n + width - 1) / width;
+  const uint first = min(id * segment, n), last = min(first + segment, n);
+
+  uint sum = 0;
+  for (uint i = first; i < last; ++i) {
+    sum += in[i];
+  }
+
+#if SUBGROUPS
+  // Sub-groups scan their segment sums in registers, only the sub-group totals go through local memory
+  const uint inclusive = sub_group_scan_inclusive_add(sum);
+  const uint group = get_sub_group_id();
+  if (get_sub_group_local_id() == get_sub_group_size() - 1) sums[group] = inclusive;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  if (id == 0) {
+    for (uint g = 0, base = 0; g < get_num_sub_groups(); ++g) {
+      const uint value = sums[g];
+      sums[g] = base;
+      base += value;
+    }
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  const uint total = sums[group] + inclusive;
+  uint running = total - sum;
+#else
+  sums[id] = sum;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (uint offset = 1; offset < width; offset <<= 1) {
+    const uint carry = (id >= offset ? sums[id - offset] : 0);
+    barrier(CLK_LOCAL_MEM_FENCE);
+    sums[id] += carry;
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  const uint total = sums[id];
+  uint running = total - sum;
+#endif
+  for (uint i = first; i < last; ++i) {
+    const uint value = in[i];
+    out[i] = running;
+    running += value;
+  }
+
+  if (id == width - 1) out[n] = total;
+}
+
+// Turns the match bits of every chunk into (line number, match end) pairs. Line numbers are the chunk's base from the
+// prefix sum plus the newlines preceding the bit, counted with popcount over the bitmap instead of the haystack.
+__kernel void collect_lines(uint haystack_size, uint chunk_size, __global const uint *newline_bits,
+                            __global const uint *match_bits, __global const uint *line_base,
+                            __global const uint *hit_offset, __global uint *hit_lines, __global uint *hit_positions) {
+  const uint chunk = get_global_id(0);
+  const uint chunk_start = chunk * chunk_size;
+  if (chunk_start >= haystack_size) return;
+
+  const uint chunk_end = min(chunk_start + chunk_size, haystack_size);
+  uint line = line_base[chunk], out = hit_offset[chunk];
+
+  for (uint w = chunk_start / WORD_BITS; w < (chunk_end + WORD_BITS - 1) / WORD_BITS; ++w) {
+    const uint newlines = newline_bits[w];
+
+    for (uint matches = match_bits[w]; matches != 0; matches &= matches - 1) {
+      const uint below = (matches & (~matches + 1)) - 1;
+      hit_lines[out] = line + popcount(newlines & below);
+      hit_positions[out] = w * WORD_BITS + popcount(below);
+      ++out;
+    }
+
+    line += popcount(newlines);
+  }
+}
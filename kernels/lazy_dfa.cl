@@ -0,0 +1,37 @@
+// @kernel({"name": "lazy_dfa_kernel", "entry": "match"})
+// @signature(["cl::Buffer", "cl_uint", "cl_uint", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer"])
+// @macros([{"type": "unsigned", "name": "NUM_CLASSES"}, {"type": "unsigned", "name": "OVERLAP"}])
+
+#define NO_NEEDLE 0xffffffffu
+#define MISS 0xffffffffu
+
+// Chunked scan over a snapshot of a lazy DFA. A transition that leaves the snapshot stops the work-item, which
+// records the position of the byte it could not consume and the state it was in; the host goes on from there. Hits
+// before the miss are already counted. Work-items that reach the end of their chunk record MISS as the position.
+__kernel void match(__global const uchar *haystack, uint haystack_size, uint chunk_size, __constant uchar *classes,
+                    __global const uint *transitions, __global const uint *needle_of,
+                    __global const uint *dict_link, __global uint *counts, __global uint2 *misses) {
+  const uint id = get_global_id(0);
+  const uint chunk_start = id * chunk_size;
+  if (chunk_start >= haystack_size) return;
+
+  const uint chunk_end = min(chunk_start + chunk_size, haystack_size);
+  uint i = (chunk_start > OVERLAP ? chunk_start - OVERLAP : 0);
+  uint state = 0;
+
+  for (; i < chunk_end; ++i) {
+    const uint next = transitions[state * NUM_CLASSES + classes[haystack[i]]];
+    if (next == MISS) {
+      misses[id] = (uint2)(i, state);
+      return;
+    }
+
+    state = next;
+    if (i < chunk_start) continue;
+    for (uint o = (needle_of[state] != NO_NEEDLE ? state : dict_link[state]); o != 0; o = dict_link[o]) {
+      atomic_inc(counts + needle_of[o]);
+    }
+  }
+
+  misses[id] = (uint2)(MISS, 0);
+}
@@ -0,0 +1,41 @@
+// @kernel({"name": "microbench_kernel", "entry": "read_global"})
+// @signature(["cl::Buffer", "cl_uint", "cl::Buffer"])
+
+// Grid-stride read of the whole buffer. Sums are written out so that the loads are not optimized away.
+__kernel void read_global(__global const uint4 *in, uint n, __global uint *out) {
+  const uint id = get_global_id(0), stride = get_global_size(0);
+  uint4 sum = 0;
+
+  for (uint i = id; i < n; i += stride) {
+    sum += in[i];
+  }
+
+  out[id] = sum.x + sum.y + sum.z + sum.w;
+}
+
+// Every work-item reads `iterations` words of the work-group tile, each step at a different offset so that the
+// compiler can not hoist the loads
+__kernel void read_local(__global uint *out, uint iterations, __local uint4 *tile) {
+  const uint lid = get_local_id(0), size = get_local_size(0);
+  tile[lid] = (uint4)(lid, lid + 1, lid + 2, lid + 3);
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  uint4 sum = 0;
+  for (uint i = 0, index = lid; i < iterations; ++i) {
+    sum += tile[index];
+    index = (index + sum.x % 2 + 1) % size;
+  }
+
+  out[get_global_id(0)] = sum.x + sum.y + sum.z + sum.w;
+}
+
+__kernel void empty() {}
+
+// `iterations` atomic increments per work-item, spread over `num_counters` counters. One counter measures the fully
+// contended case, one counter per work-item the uncontended one.
+__kernel void increment(__global volatile uint *counters, uint num_counters, uint iterations) {
+  const uint slot = get_global_id(0) % num_counters;
+  for (uint i = 0; i < iterations; ++i) {
+    atomic_inc(&counters[slot]);
+  }
+}
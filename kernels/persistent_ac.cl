@@ -0,0 +1,74 @@
+// @kernel({"name": "persistent_ac_kernel", "entry": "serve"})
+// @signature(["cl::Buffer", "cl::Buffer", "cl_uint", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer"])
+// @macros([{"type": "unsigned", "name": "NUM_CLASSES"}, {"type": "unsigned", "name": "OVERLAP"}, {"type": "unsigned", "name": "SVM_ATOMICS"}])
+
+#define NO_NEEDLE 0xffffffffu
+
+// Slots of the control block, see persistent_engine
+#define CONTROL_HEAD 0      // Next ticket handed out to a work-group
+#define CONTROL_TAIL 1      // Number of published descriptors
+#define CONTROL_COMPLETED 2 // Number of processed descriptors
+#define CONTROL_STOP 3      // Set once no more descriptors will be published
+#define CONTROL_SLOT 4      // Processed descriptors of each arena slot, one counter per slot
+
+// The host talks to a running kernel only through fine-grained SVM atomics. Without them the queue is filled before
+// the launch and device scope is enough.
+#if SVM_ATOMICS
+#define HOST_SCOPE memory_scope_all_svm_devices
+#else
+#define HOST_SCOPE memory_scope_device
+#endif
+
+// Work-groups pull descriptors from a ring until the host sets the stop flag. A descriptor is (first counted byte,
+// end, first byte available for warm-up, arena slot) in the arena; the group splits it between its work-items, and
+// each of them scans its part the same way the chunked engine scans a chunk. Groups finish in any order, so the
+// host reuses a slot only once the counter of that slot covers everything published into it.
+__kernel void serve(__global atomic_uint *control, __global const uint4 *descriptors, uint capacity,
+                    __global const uchar *arena, __constant uchar *classes, __global const uint *transitions,
+                    __global const uint *needle_of, __global const uint *dict_link, __global atomic_uint *counts) {
+  __local uint ticket;
+  __local int quit;
+
+  for (;;) {
+    if (get_local_id(0) == 0) {
+      ticket = atomic_fetch_add_explicit(control + CONTROL_HEAD, 1, memory_order_relaxed, memory_scope_device);
+      quit = 0;
+
+      while (ticket >= atomic_load_explicit(control + CONTROL_TAIL, memory_order_acquire, HOST_SCOPE)) {
+        if (!atomic_load_explicit(control + CONTROL_STOP, memory_order_acquire, HOST_SCOPE)) continue;
+
+        // The tail is final once the stop flag is seen
+        quit = (ticket >= atomic_load_explicit(control + CONTROL_TAIL, memory_order_acquire, HOST_SCOPE));
+        if (quit) break;
+      }
+    }
+
+    work_group_barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+    if (quit) return;
+
+    const uint4 d = descriptors[ticket % capacity];
+    const uint span = (d.y - d.x + get_local_size(0) - 1) / get_local_size(0);
+    const uint chunk_start = min(d.x + (uint)get_local_id(0) * span, d.y);
+    const uint chunk_end = min(chunk_start + span, d.y);
+
+    uint i = (chunk_start - d.z > OVERLAP ? chunk_start - OVERLAP : d.z);
+    uint state = 0;
+
+    for (; i < chunk_start; ++i) {
+      state = transitions[state * NUM_CLASSES + classes[arena[i]]];
+    }
+
+    for (; i < chunk_end; ++i) {
+      state = transitions[state * NUM_CLASSES + classes[arena[i]]];
+      for (uint o = (needle_of[state] != NO_NEEDLE ? state : dict_link[state]); o != 0; o = dict_link[o]) {
+        atomic_fetch_add_explicit(counts + needle_of[o], 1, memory_order_relaxed, memory_scope_device);
+      }
+    }
+
+    work_group_barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+    if (get_local_id(0) == 0) {
+      atomic_fetch_add_explicit(control + CONTROL_SLOT + d.w, 1, memory_order_release, HOST_SCOPE);
+      atomic_fetch_add_explicit(control + CONTROL_COMPLETED, 1, memory_order_release, HOST_SCOPE);
+    }
+  }
+}
@@ -0,0 +1,37 @@
+// @kernel({"name": "pfac_kernel", "entry": "match"})
+// @signature(["cl::Buffer", "cl_uint", "cl::Buffer", "cl::Memory", "cl::Buffer", "cl::Buffer"])
+// @macros([{"type": "unsigned", "name": "NUM_CLASSES"}, {"type": "unsigned", "name": "TRIE_MEMORY"}])
+
+#define NO_NEEDLE 0xffffffffu
+
+// Where the failureless trie lives, see pfac_engine::trie_memory
+#define TRIE_MEMORY_GLOBAL 0
+#define TRIE_MEMORY_CONSTANT 1
+#define TRIE_MEMORY_IMAGE 2
+
+#if TRIE_MEMORY == TRIE_MEMORY_IMAGE
+__constant sampler_t trie_sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_NONE | CLK_FILTER_NEAREST;
+#define TRIE_PARAM __read_only image2d_t trie
+#define TRIE_NEXT(state, symbol) read_imageui(trie, trie_sampler, (int2)((symbol), (state))).x
+#elif TRIE_MEMORY == TRIE_MEMORY_CONSTANT
+#define TRIE_PARAM __constant uint *trie
+#define TRIE_NEXT(state, symbol) trie[(state)*NUM_CLASSES + (symbol)]
+#else
+#define TRIE_PARAM __global const uint *trie
+#define TRIE_NEXT(state, symbol) trie[(state)*NUM_CLASSES + (symbol)]
+#endif
+
+// Parallel Failureless Aho-Corasick. Every work-item starts at its own byte and walks the trie until there is no edge
+// to follow, so there are no failure transitions and no chunk boundaries to take care of.
+__kernel void match(__global const uchar *haystack, uint haystack_size, __constant uchar *classes, TRIE_PARAM,
+                    __global const uint *needle_of, __global uint *counts) {
+  const uint start = get_global_id(0);
+  if (start >= haystack_size) return;
+
+  uint state = 0;
+  for (uint i = start; i < haystack_size; ++i) {
+    state = TRIE_NEXT(state, classes[haystack[i]]);
+    if (state == 0) return;
+    if (needle_of[state] != NO_NEEDLE) atomic_inc(counts + needle_of[state]);
+  }
+}
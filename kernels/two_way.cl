@@ -0,0 +1,49 @@
+// @kernel({"name": "two_way_kernel", "entry": "match"})
+// @signature(["cl::Buffer", "cl_uint", "cl_uint", "cl::Buffer", "cl::Buffer", "cl_uint", "cl_uint", "cl_uint", "cl_uint", "cl_uint", "cl_uint", "cl::Buffer"])
+
+// Every work-item runs the Two-Way scan (see matching::two_way_needle) over its own range of chunk_size alignments.
+// An alignment is only verified when the haystack holds the needle's two rarest symbols at their offsets; otherwise
+// the scan moves on by one and forgets the remembered prefix. Shifts never skip a match, so a scan that jumps past the
+// end of its range has seen all of its matches. The needle is translated to byte classes.
+__kernel void match(__global const uchar *haystack, uint haystack_size, uint chunk_size, __constant uchar *classes,
+                    __global const uchar *needle, uint length, uint critical, uint period, uint periodic,
+                    uint rare0, uint rare1, __global uint *counts) {
+  if (haystack_size < length) return;
+
+  const uint last = haystack_size - length;
+  const uint start = get_global_id(0) * chunk_size;
+  if (start > last) return;
+  const uint end = min(start + chunk_size - 1, last);
+
+  const uchar symbol0 = needle[rare0], symbol1 = needle[rare1];
+  uint found = 0, memory = 0;
+
+  for (uint j = start; j <= end;) {
+    if (classes[haystack[j + rare0]] != symbol0 || classes[haystack[j + rare1]] != symbol1) {
+      ++j;
+      memory = 0;
+      continue;
+    }
+
+    uint i = max(critical, memory);
+    while (i < length && needle[i] == classes[haystack[i + j]]) {
+      ++i;
+    }
+    if (i < length) {
+      j += i - critical + 1;
+      memory = 0;
+      continue;
+    }
+
+    int left = (int)critical - 1;
+    while (left >= (int)memory && needle[left] == classes[haystack[left + j]]) {
+      --left;
+    }
+    if (left < (int)memory) ++found;
+
+    j += period;
+    memory = (periodic ? length - period : 0);
+  }
+
+  if (found) atomic_add(counts, found);
+}
@@ -0,0 +1,113 @@
+// @kernel({"name": "wildcard_kernel", "entry": "compare"})
+// @signature(["cl::Buffer", "cl_uint", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "cl_uint", "cl::Buffer"])
+
+// Masked needles are stored as byte classes with a mask per position, needle i taking [offsets[i], offsets[i + 1]).
+// Positions with a zero mask match any byte.
+
+bool matches_at(__global const uchar *haystack, uint haystack_size, __constant uchar *classes,
+                __global const uchar *symbols, __global const uchar *mask, uint first, uint length, uint position) {
+  if (position + length > haystack_size) return false;
+  for (uint j = 0; j < length; ++j) {
+    if (mask[first + j] && classes[haystack[position + j]] != symbols[first + j]) return false;
+  }
+  return true;
+}
+
+// Direct comparison: every work-item checks all needles at its own position
+__kernel void compare(__global const uchar *haystack, uint haystack_size, __constant uchar *classes,
+                      __global const uchar *symbols, __global const uchar *mask, __global const uint *offsets,
+                      uint num_needles, __global uint *counts) {
+  const uint position = get_global_id(0);
+  if (position >= haystack_size) return;
+
+  for (uint i = 0; i < num_needles; ++i) {
+    const uint first = offsets[i], length = offsets[i + 1] - first;
+    if (matches_at(haystack, haystack_size, classes, symbols, mask, first, length, position)) {
+      atomic_inc(counts + i);
+    }
+  }
+}
+
+// FFT matching scores every position with the sum of squared differences over the unmasked needle positions,
+//   S(i) = sum w[j] (p[j] - t[i + j])^2 = sum w[j] p[j]^2 - 2 sum w[j] p[j] t[i + j] + sum w[j] t[i + j]^2,
+// where the last two sums are correlations of t and t^2 with w p and w. Both are computed as one complex convolution
+// per block of the haystack (overlap-save), and S(i) == 0 exactly at the matches.
+
+float2 complex_mul(float2 a, float2 b) {
+  return (float2)(a.x * b.x - a.y * b.y, a.x * b.y + a.y * b.x);
+}
+
+// Block b of the batch holds the haystack from first + b * step on, packed as t + i t^2 and zero-padded at its end
+__kernel void load_text(__global const uchar *haystack, uint haystack_size, __constant uchar *classes, uint first,
+                        uint step, uint n, __global float2 *out) {
+  const uint k = get_global_id(0), b = get_global_id(1);
+  const uint position = first + b * step + k;
+  const float t = (position < haystack_size ? classes[haystack[position]] : 0.0f);
+  out[b * n + k] = (float2)(t, t * t);
+}
+
+// The needle reversed and packed as w p + i w, so that convolving with it correlates
+__kernel void load_needle(__global const uchar *symbols, __global const uchar *mask, uint first, uint length, uint n,
+                          __global float2 *out) {
+  const uint k = get_global_id(0);
+  if (k >= length) {
+    out[k] = 0;
+    return;
+  }
+
+  const float w = mask[first + length - 1 - k], p = symbols[first + length - 1 - k];
+  out[k] = (float2)(w * p, w);
+}
+
+// One radix-2 Stockham pass over a batch of transforms of size n. `span` is the size of the sub-transforms already
+// done (1, 2, 4, ...), sign -1 transforms forward and +1 backward without scaling. Results go to `out`, which is
+// swapped with `in` between passes.
+__kernel void fft_pass(__global const float2 *in, __global float2 *out, uint n, uint span, float sign) {
+  const uint j = get_global_id(0), b = get_global_id(1);
+  const uint k = j & (span - 1);
+
+  const float2 x0 = in[b * n + j];
+  float cosine;
+  const float sine = sincos(sign * M_PI_F * k / span, &cosine);
+  const float2 x1 = complex_mul(in[b * n + j + n / 2], (float2)(cosine, sine));
+
+  const uint target = b * n + ((j - k) << 1) + k;
+  out[target] = x0 + x1;
+  out[target + span] = x0 - x1;
+}
+
+// Unpacks the spectra of the two real sequences of the text block (t, t^2) and the needle (w p, w) and multiplies
+// them pairwise, so that the backward transform yields both correlations as real and imaginary part
+__kernel void multiply(__global const float2 *text, __global const float2 *needle, uint n, __global float2 *out) {
+  const uint k = get_global_id(0), b = get_global_id(1);
+  const uint mirror = (n - k) & (n - 1);
+
+  const float2 z = text[b * n + k], zm = text[b * n + mirror];
+  const float2 t1 = 0.5f * (float2)(z.x + zm.x, z.y - zm.y);
+  const float2 t2 = 0.5f * (float2)(z.y + zm.y, zm.x - z.x);
+
+  const float2 u = needle[k], um = needle[mirror];
+  const float2 wp = 0.5f * (float2)(u.x + um.x, u.y - um.y);
+  const float2 w = 0.5f * (float2)(u.y + um.y, um.x - u.x);
+
+  const float2 c2 = complex_mul(t2, w);
+  out[b * n + k] = complex_mul(t1, wp) + (float2)(-c2.y, c2.x);
+}
+
+// Output k of a block is the correlation at position first + b * step + k, which ends at index k + length - 1 of the
+// circular convolution. Scores below `tolerance` are verified by direct comparison, so rounding in the transforms
+// can only cost extra comparisons and never a wrong count.
+__kernel void score(__global const float2 *correlation, __global const uchar *haystack, uint haystack_size,
+                    __constant uchar *classes, __global const uchar *symbols, __global const uchar *mask, uint first,
+                    uint length, float weight, float tolerance, uint start, uint step, uint n,
+                    __global uint *counts, uint needle) {
+  const uint k = get_global_id(0), b = get_global_id(1);
+  const uint position = start + b * step + k;
+  if (position + length > haystack_size) return;
+
+  const float2 c = correlation[b * n + k + length - 1] / n;
+  const float s = weight - 2.0f * c.x + c.y;
+  if (fabs(s) < tolerance && matches_at(haystack, haystack_size, classes, symbols, mask, first, length, position)) {
+    atomic_inc(counts + needle);
+  }
+}
@@ -0,0 +1,396 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "common/opencl_include.hpp"
+#include "common/thread_pool.hpp"
+#include "common/utils.hpp"
+
+#include "matching/compressed_automaton.hpp"
+#include "matching/device.hpp"
+#include "matching/engines.hpp"
+#include "matching/host_matcher.hpp"
+#include "matching/io.hpp"
+#include "matching/planner.hpp"
+#include "matching/random.hpp"
+#include "matching/tenants.hpp"
+#include "matching/wildcard_engine.hpp"
+
+#include "popl.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+struct bench_result {
+  std::string engine, memory;
+  std::size_t footprint;
+  clutils::profiling_info best;
+};
+
+void print_results(const std::vector<bench_result> &results, std::size_t haystack_size) {
+  std::cout << std::left << std::setw(16) << "engine" << std::setw(8) << "memory" << std::setw(16) << "automaton, MiB"
+            << std::setw(12) << "pure, ms" << std::setw(12) << "wall, ms" << "pure, GB/s\n";
+
+  for (const auto &r : results) {
+    std::cout << std::left << std::fixed << std::setprecision(2) << std::setw(16) << r.engine << std::setw(8)
+              << r.memory << std::setw(16) << r.footprint / 1048576.0 << std::setw(12);
+    if (!r.best.has_pure()) {
+      std::cout << "n/a" << std::setw(12) << r.best.wall.count() << "n/a\n";
+      continue;
+    }
+    const auto pure = std::max(r.best.pure.count(), 1e-3);
+    std::cout << r.best.pure.count() << std::setw(12) << r.best.wall.count()
+              << static_cast<double>(haystack_size) / pure / 1e6 << "\n";
+  }
+}
+
+// Best of `reps` runs over the whole haystack, checked against the expected counts
+bench_result measure(
+    matching::engine &engine, const std::string &name, const std::string &memory, std::string_view haystack,
+    unsigned reps, const std::vector<unsigned> &expected
+) {
+  const auto max_time = std::chrono::milliseconds::max();
+  bench_result res{name, memory, engine.footprint(), {max_time, max_time}};
+
+  for (unsigned i = 0; i < reps; ++i) {
+    const auto run = engine.match(haystack);
+    if (run.counts != expected) throw std::runtime_error{"Engine " + name + " produced wrong counts"};
+    res.best.pure = (run.time.has_pure() ? std::min(res.best.pure, run.time.pure) : run.time.pure);
+    res.best.wall = std::min(res.best.wall, run.time.wall);
+  }
+
+  return res;
+}
+
+// Best host to device bandwidth in GB/s over a few blocking uploads of the same data
+double upload_rate(const matching::device_context &ctx, std::string_view data, unsigned reps) {
+  auto buffer = ctx.pool().acquire(data.size());
+  auto best = std::chrono::nanoseconds::max();
+
+  for (unsigned i = 0; i < reps; ++i) {
+    cl::Event event;
+    ctx.queue().enqueueWriteBuffer(buffer, CL_TRUE, 0, data.size(), data.data(), nullptr, &event);
+    best = std::min(best, matching::event_duration(event));
+  }
+
+  return static_cast<double>(data.size()) / std::max<long>(best.count(), 1);
+}
+
+// Stream throughput: the haystack is fed to the engine in batches of `batch_size` bytes, one match() per batch
+void run_batches(
+    matching::engine &engine, std::string_view haystack, std::size_t batch_size, unsigned reps,
+    const std::vector<unsigned> &expected
+) {
+  const auto num_batches = (haystack.size() + batch_size - 1) / batch_size;
+  auto best = std::chrono::nanoseconds::max();
+  clutils::profiling_info kernels{std::chrono::milliseconds::max(), {}};
+
+  for (unsigned i = 0; i < reps; ++i) {
+    std::vector<unsigned> total(expected.size(), 0);
+    clutils::profiling_info pass{};
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    for (std::size_t offset = 0; offset < haystack.size(); offset += batch_size) {
+      const auto run = engine.match(haystack.substr(offset, batch_size));
+      std::transform(total.begin(), total.end(), run.counts.begin(), total.begin(), std::plus{});
+      pass.pure += run.time.pure;
+    }
+
+    best = std::min(best, std::chrono::high_resolution_clock::now() - start);
+    kernels.pure = (pass.has_pure() ? std::min(kernels.pure, pass.pure) : pass.pure);
+    if (total != expected) throw std::runtime_error{"Engine " + engine.name() + " produced wrong batch counts"};
+  }
+
+  // Kernel time is summed over the batches, engines that can't time their kernels per batch show n/a
+  const auto nanos = std::max<long>(best.count(), 1);
+  std::cout << std::left << std::fixed << std::setprecision(2) << std::setw(16) << engine.name() << std::setw(12);
+  if (kernels.has_pure()) {
+    std::cout << kernels.pure.count();
+  } else {
+    std::cout << "n/a";
+  }
+  std::cout << std::setw(12) << nanos / 1e6 << std::setw(16) << nanos / 1e3 / num_batches
+            << static_cast<double>(haystack.size()) / nanos << "\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv) try {
+  popl::OptionParser op("Allowed options");
+
+  auto help_option = op.add<popl::Switch>("h", "help", "Print this help message");
+  auto dict_option = op.add<popl::Value<std::string>>("d", "dict", "Dictionary file, random needles if not set");
+  auto count_option = op.add<popl::Value<unsigned>>("n", "needles", "Number of random needles", 1000);
+  auto min_option = op.add<popl::Value<unsigned>>("", "min-length", "Minimum length of random needles", 4);
+  auto max_option = op.add<popl::Value<unsigned>>("", "max-length", "Maximum length of random needles", 16);
+  auto size_option = op.add<popl::Value<unsigned>>("s", "size", "Size of random haystack in MiB", 64);
+  auto alphabet_option = op.add<popl::Value<std::string>>(
+      "a", "alphabet", "Alphabet of random haystack", "abcdefghijklmnopqrstuvwxyz"
+  );
+  auto reps_option = op.add<popl::Value<unsigned>>("r", "repeat", "Number of runs, the best one is reported", 5);
+  auto engine_option = op.add<popl::Value<std::string>>("e", "engine", "Engine to benchmark (may be repeated)");
+  auto calibrate_option = op.add<popl::Value<std::string>>(
+      "", "calibrate", "Fit the engine selection cost model on this machine and write it to the file"
+  );
+  auto batch_option = op.add<popl::Value<unsigned>>(
+      "", "batch", "Also compare per-batch launches with the persistent engine on batches of this many KiB"
+  );
+  auto hot_option = op.add<popl::Value<unsigned>>(
+      "", "hot", "Build the random haystack from this many random words repeated back to back, so that hits collide"
+  );
+  auto counting_option =
+      op.add<popl::Switch>("", "counting", "Also compare the hit counting strategies of the ac engine");
+  auto packing_option = op.add<popl::Switch>(
+      "", "packing", "Also run the ac engine without packing haystacks of small alphabets into 2 or 4 bits"
+  );
+  auto wildcards_option = op.add<popl::Value<unsigned>>(
+      "", "wildcards", "Also compare FFT and direct matching of masked needles of this many bytes cut from the haystack"
+  );
+  auto wildcard_needles_option =
+      op.add<popl::Value<unsigned>>("", "wildcard-needles", "Number of masked needles for --wildcards", 4);
+  auto tenants_option = op.add<popl::Value<unsigned>>(
+      "", "tenants", "Also compare separate passes over this many tenant dictionaries with one merged pass"
+  );
+  auto pin_option = op.add<popl::Switch>("", "pin-threads", "Bind host worker threads to CPUs, one thread per CPU");
+  auto verbose_option = op.add<popl::Switch>("v", "verbose", "Print device selection information");
+
+  op.parse(argc, argv);
+
+  if (help_option->is_set()) {
+    std::cout << op << "\n";
+    return EXIT_SUCCESS;
+  }
+
+  clutils::pin_default_thread_pool(pin_option->is_set());
+
+  if (calibrate_option->is_set()) {
+    matching::device_context ctx{verbose_option->is_set()};
+    const auto model = matching::calibrate(ctx, &std::cout);
+    model.save(calibrate_option->value());
+    model.save(std::cout);
+    return EXIT_SUCCESS;
+  }
+
+  const auto random_size = std::size_t{size_option->value()} << 20;
+  const auto make_random_haystack = [&] {
+    if (!hot_option->is_set()) return matching::random_haystack(random_size, alphabet_option->value());
+    return matching::repeated_haystack(
+        random_size, alphabet_option->value(), std::max(hot_option->value(), 1u), std::max(min_option->value(), 1u),
+        std::max(max_option->value(), 1u)
+    );
+  };
+  const auto haystack = (op.non_option_args().empty() ? make_random_haystack()
+                                                      : matching::read_haystack(op.non_option_args().front()));
+  if (haystack.size() <= max_option->value()) throw std::invalid_argument{"Haystack is too small"};
+
+  const auto needles =
+      (dict_option->is_set()
+           ? matching::read_dictionary(dict_option->value())
+           : matching::random_dictionary(haystack, count_option->value(), min_option->value(), max_option->value()));
+
+  std::vector<std::string> engines{matching::engine_names.begin(), matching::engine_names.end()};
+  if (engine_option->is_set()) {
+    engines.clear();
+    for (unsigned i = 0; i < engine_option->count(); ++i) {
+      engines.push_back(engine_option->value(i));
+    }
+  }
+
+  // The host reference is compiled on the pool while the device context is set up
+  auto &pool = clutils::default_thread_pool();
+  auto reference_build = pool.submit([&] { return matching::compressed_automaton{needles.begin(), needles.end()}; });
+  matching::device_context ctx{verbose_option->is_set(), matching::memory_mode::buffer};
+
+  const auto reference = pool.wait(reference_build);
+  std::cout << "Haystack: " << haystack.size() << " bytes, needles: " << needles.size()
+            << ", automaton states: " << reference.num_states() << "\n";
+  const auto expected = matching::parallel_count(reference, haystack);
+
+  auto pinned = ctx.make_pinned_buffer();
+  pinned.assign(haystack.begin(), haystack.end());
+  std::cout << std::fixed << std::setprecision(2)
+            << "Host to device: pageable " << upload_rate(ctx, haystack, reps_option->value()) << " GB/s, pinned "
+            << upload_rate(ctx, {pinned.data(), pinned.size()}, reps_option->value()) << " GB/s\n";
+
+  // Engines are fed from the host memory of the context, the same way matcher reads its inputs
+  std::vector<bench_result> results;
+  const auto run_engines = [&](const matching::device_context &run_ctx) {
+    auto host = run_ctx.make_pinned_buffer();
+    host.assign(haystack.begin(), haystack.end());
+    const std::string_view host_haystack{host.data(), host.size()};
+
+    const auto run = [&](matching::engine &engine, const std::string &name) {
+      results.push_back(
+          measure(engine, name, to_string(run_ctx.mode()), host_haystack, reps_option->value(), expected)
+      );
+    };
+
+    for (const auto &name : engines) {
+      matching::build_report report;
+      auto engine = matching::make_engine(
+          name, run_ctx, needles, matching::byte_classes::identity(), matching::default_chunk_size, &report
+      );
+      if (verbose_option->is_set() && !report.phases.empty()) std::cout << name << " automaton build:\n" << report;
+      run(*engine, name);
+    }
+
+    // The ac row above already packs whenever the haystack allows it
+    if (packing_option->is_set()) {
+      matching::aho_corasick_engine bytes{
+          run_ctx, matching::automaton{needles.begin(), needles.end()}, matching::default_chunk_size,
+          matching::counting::automatic, false};
+      run(bytes, "ac/bytes");
+    }
+
+    if (!counting_option->is_set()) return;
+
+    // Strategies whose table does not fit into local memory are skipped
+    using matching::counting;
+    for (const auto strategy : {counting::global, counting::local, counting::local_hash}) {
+      std::unique_ptr<matching::aho_corasick_engine> engine;
+      try {
+        engine = std::make_unique<matching::aho_corasick_engine>(
+            run_ctx, matching::automaton{needles.begin(), needles.end()}, matching::default_chunk_size, strategy
+        );
+      } catch (std::invalid_argument &) {
+        continue;
+      }
+
+      run(*engine, "ac/" + to_string(strategy));
+    }
+  };
+
+  run_engines(ctx);
+  if (matching::supports_fine_grained_svm(ctx.device())) {
+    run_engines(matching::device_context{false, matching::memory_mode::svm});
+  }
+
+  print_results(results, haystack.size());
+
+  if (wildcards_option->is_set()) {
+    const auto length = std::max(wildcards_option->value(), 1u);
+    if (haystack.size() <= length) throw std::invalid_argument{"Haystack is too small for the masked needles"};
+
+    const matching::masked_needles masked{
+        matching::random_masked_patterns(haystack, std::max(wildcard_needles_option->value(), 1u), length)};
+    const auto expected_masked = matching::parallel_count(masked, haystack);
+
+    std::cout << "\nMasked needles: " << masked.num_needles() << " of " << length << " bytes\n";
+    std::vector<bench_result> wildcard_results;
+    for (const auto method : {matching::wildcard_method::compare, matching::wildcard_method::fft}) {
+      matching::wildcard_engine engine{ctx, masked, method};
+      wildcard_results.push_back(measure(
+          engine, engine.name(), to_string(ctx.mode()), {pinned.data(), pinned.size()}, reps_option->value(),
+          expected_masked
+      ));
+    }
+    print_results(wildcard_results, haystack.size());
+  }
+
+  if (tenants_option->is_set()) {
+    // Needles are dealt to the tenants in turn, so the counts of every tenant are a slice of the expected ones
+    const auto num_tenants = std::clamp<std::size_t>(tenants_option->value(), 1, needles.size());
+    matching::tenant_dictionaries tenants;
+    std::vector<std::vector<unsigned>> tenant_expected(num_tenants);
+    for (std::size_t t = 0; t < num_tenants; ++t) {
+      std::vector<std::string> tenant_needles;
+      for (std::size_t i = t; i < needles.size(); i += num_tenants) {
+        tenant_needles.push_back(needles[i]);
+        tenant_expected[t].push_back(expected[i]);
+      }
+      tenants.add("tenant" + std::to_string(t), std::move(tenant_needles));
+    }
+
+    const auto &name = engines.front();
+    const std::string_view pinned_haystack{pinned.data(), pinned.size()};
+    const auto max_time = std::chrono::milliseconds::max();
+
+    // Separate passes are timed as their sum, one engine per tenant
+    std::vector<std::unique_ptr<matching::engine>> separate;
+    bench_result separate_result{name + "/separate", to_string(ctx.mode()), 0, {max_time, max_time}};
+    for (std::size_t t = 0; t < num_tenants; ++t) {
+      separate.push_back(matching::make_engine(name, ctx, tenants.needles(t)));
+      separate_result.footprint += separate.back()->footprint();
+    }
+    for (unsigned i = 0; i < reps_option->value(); ++i) {
+      clutils::profiling_info total{};
+      for (std::size_t t = 0; t < num_tenants; ++t) {
+        const auto run = separate[t]->match(pinned_haystack);
+        if (run.counts != tenant_expected[t]) throw std::runtime_error{"Separate pass produced wrong counts"};
+        total.pure += run.time.pure;
+        total.wall += run.time.wall;
+      }
+      separate_result.best.pure = std::min(separate_result.best.pure, total.pure);
+      separate_result.best.wall = std::min(separate_result.best.wall, total.wall);
+    }
+    separate.clear();
+
+    std::vector<unsigned> merged_expected;
+    for (const auto &counts : tenant_expected) {
+      merged_expected.insert(merged_expected.end(), counts.begin(), counts.end());
+    }
+    auto merged = matching::make_engine(name, ctx, tenants.merged());
+    const auto merged_result = measure(
+        *merged, name + "/merged", to_string(ctx.mode()), pinned_haystack, reps_option->value(), merged_expected
+    );
+    for (const auto &[tenant, counts] : tenants.demultiplex(merged->match(pinned_haystack).counts)) {
+      if (counts != tenant_expected[tenant]) throw std::runtime_error{"Merged pass produced wrong tenant counts"};
+    }
+
+    std::cout << "\nTenants: " << num_tenants << "\n";
+    print_results({separate_result, merged_result}, haystack.size());
+  }
+
+  if (batch_option->is_set()) {
+    const auto batch_size = std::max<std::size_t>(std::size_t{batch_option->value()} << 10, 1);
+
+    // Matches crossing a batch boundary are lost, so the reference is counted per batch as well
+    std::vector<unsigned> expected_batches(reference.num_needles(), 0);
+    for (std::size_t offset = 0; offset < haystack.size(); offset += batch_size) {
+      const auto counts = reference.count(std::string_view{haystack}.substr(offset, batch_size));
+      std::transform(
+          expected_batches.begin(), expected_batches.end(), counts.begin(), expected_batches.begin(), std::plus{}
+      );
+    }
+
+    auto stream_engines = engines;
+    if (matching::supports_opencl_c2(ctx.device())) stream_engines.emplace_back(matching::persistent_engine_name);
+
+    std::cout << "\nBatches of " << batch_size << " bytes:\n"
+              << std::left << std::setw(16) << "engine" << std::setw(12) << "pure, ms" << std::setw(12) << "wall, ms"
+              << std::setw(16) << "per batch, us" << "GB/s\n";
+    for (const auto &name : stream_engines) {
+      auto engine = matching::make_engine(name, ctx, needles);
+      run_batches(*engine, {pinned.data(), pinned.size()}, batch_size, reps_option->value(), expected_batches);
+    }
+  }
+
+  if (verbose_option->is_set()) std::cout << "Buffer pool: " << ctx.pool().stats() << "\n";
+} catch (cl::Error &e) {
+  std::cerr << "OpenCL error: " << e.what() << "\n";
+  return EXIT_FAILURE;
+} catch (std::exception &e) {
+  std::cerr << "Encountered error: " << e.what() << "\n";
+  return EXIT_FAILURE;
+} catch (...) {
+  std::cerr << "Unknown error\n";
+  return EXIT_FAILURE;
+}
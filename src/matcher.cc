@@ -0,0 +1,554 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "common/opencl_include.hpp"
+#include "common/thread_pool.hpp"
+
+#include "matching/alphabet.hpp"
+#include "matching/compressed_automaton.hpp"
+#include "matching/compressed_engine.hpp"
+#include "matching/device.hpp"
+#include "matching/engines.hpp"
+#include "matching/fm_engine.hpp"
+#include "matching/fm_index.hpp"
+#include "matching/grep.hpp"
+#include "matching/host_matcher.hpp"
+#include "matching/io.hpp"
+#include "matching/lazy_dfa_engine.hpp"
+#include "matching/numa_engine.hpp"
+#include "matching/pattern.hpp"
+#include "matching/planner.hpp"
+#include "matching/stream.hpp"
+#include "matching/tenants.hpp"
+#include "matching/wildcard_engine.hpp"
+
+#include "popl.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+int main(int argc, char **argv) try {
+  popl::OptionParser op("Allowed options");
+
+  auto help_option = op.add<popl::Switch>("h", "help", "Print this help message");
+  auto dict_option = op.add<popl::Value<std::string>>("d", "dict", "Dictionary file with one needle per line");
+  auto tenant_option = op.add<popl::Value<std::string>>(
+      "t", "tenant", "Tenant dictionary as name=file, matched with the others in one pass (may be repeated)"
+  );
+  auto icase_option = op.add<popl::Switch>("i", "ignore-case", "Match ASCII letters case-insensitively");
+  auto patterns_option = op.add<popl::Switch>(
+      "p", "patterns", "Dictionary lines are patterns with ?, [byte sets] and {n,m} repeats instead of literal needles"
+  );
+  auto max_states_option = op.add<popl::Value<std::size_t>>(
+      "", "max-states", "Largest DFA the patterns may compile into", matching::default_max_dfa_states
+  );
+  auto lazy_states_option = op.add<popl::Value<std::size_t>>(
+      "", "lazy-states", "States the lazy-dfa engine keeps cached and runs on the device at most",
+      matching::lazy_dfa::default_cache_states
+  );
+  auto tokens_option = op.add<popl::Value<unsigned>>(
+      "", "tokens",
+      "Dictionary lines are space separated symbol ids and inputs are arrays of symbols of this many bits (16 or 32)"
+  );
+  auto class_option =
+      op.add<popl::Value<std::string>>("c", "class", "Treat all bytes of the string as equal (may be repeated)");
+  auto engine_option = op.add<popl::Value<std::string>>(
+      "e", "engine",
+      "Matching engine: auto, ac, pfac, ac-compressed, ac-persistent, and for patterns lazy-dfa, fft, compare", "auto"
+  );
+  auto memory_option = op.add<popl::Value<std::string>>(
+      "", "memory", "How data reaches the device: auto, buffer, svm (fine-grained shared virtual memory)", "auto"
+  );
+  auto cpu_option = op.add<popl::Switch>("", "cpu", "Run on a CPU device instead of a GPU");
+  auto numa_option = op.add<popl::Switch>(
+      "", "numa", "Split the CPU device by NUMA node, replicate the automaton per node and shard the haystack"
+  );
+  auto model_option = op.add<popl::Value<std::string>>("m", "model", "Cost model file written by bench --calibrate");
+  auto verbose_option = op.add<popl::Switch>("v", "verbose", "Print device selection and timing information");
+  auto pin_option = op.add<popl::Switch>("", "pin-threads", "Bind host worker threads to CPUs, one thread per CPU");
+  auto host_option = op.add<popl::Switch>("", "host", "Also run the host implementation and compare results");
+  auto grep_option = op.add<popl::Switch>(
+      "g", "grep", "Print the lines that contain any needle, prefixed with their line numbers"
+  );
+  auto count_lines_option = op.add<popl::Switch>("", "count", "With --grep print only the number of matching lines");
+  auto files_option =
+      op.add<popl::Switch>("l", "files-with-matches", "With --grep print only the names of inputs that match");
+  auto stream_chunk_option = op.add<popl::Value<unsigned>>(
+      "", "stream-chunk", "Size in MiB of the pieces compressed inputs are decoded and matched in", 64
+  );
+  auto build_index_option = op.add<popl::Value<std::string>>(
+      "", "build-index", "Build an FM-index of the input, write it to the file and exit"
+  );
+  auto index_option = op.add<popl::Value<std::string>>(
+      "", "index", "Count needles in the text of an FM-index file instead of scanning inputs"
+  );
+  auto daemon_option = op.add<popl::Switch>(
+      "", "daemon",
+      "Read haystack file names from standard input and match them one by one, :add name=file and :drop name change "
+      "tenants"
+  );
+  auto cache_option = op.add<popl::Value<unsigned>>(
+      "", "cache", "Device memory in MiB that keeps haystacks resident between daemon jobs, 0 for half of it", 0
+  );
+
+  op.parse(argc, argv);
+
+  if (help_option->is_set()) {
+    std::cout << op << "\n";
+    return EXIT_SUCCESS;
+  }
+
+  clutils::pin_default_thread_pool(pin_option->is_set());
+
+  // Index builds are a host-only step over a single input and need neither a dictionary nor a device
+  if (build_index_option->is_set()) {
+    const auto &inputs = op.non_option_args();
+    if (inputs.size() > 1) throw std::invalid_argument{"Index is built over a single input"};
+
+    std::string text;
+    if (inputs.empty()) {
+      text = matching::read_haystack(std::cin);
+    } else {
+      matching::decompressing_reader reader{inputs.front()};
+      text = matching::read_stream(reader, std::move(text));
+    }
+
+    matching::build_report report;
+    const auto index = matching::fm_index::build(
+        text, clutils::default_thread_pool(), matching::fm_index::default_block_size, &report
+    );
+    index.save(build_index_option->value());
+    if (verbose_option->is_set()) std::cout << "Info: Index build:\n" << report;
+    return EXIT_SUCCESS;
+  }
+
+  if (dict_option->is_set() == tenant_option->is_set()) {
+    std::cerr << "Either a dictionary file or tenant dictionaries are required\n" << op << "\n";
+    return EXIT_FAILURE;
+  }
+
+  // Tenant dictionaries are merged into one, and the counts of every match are split back per tenant
+  matching::tenant_dictionaries tenants;
+  const auto add_tenant = [&](const std::string &spec) {
+    const auto separator = spec.find('=');
+    if (separator == std::string::npos || separator == 0) {
+      throw std::invalid_argument{"Tenant must be given as name=file, got " + spec};
+    }
+    tenants.add(spec.substr(0, separator), matching::read_dictionary(spec.substr(separator + 1)));
+  };
+  for (unsigned i = 0; i < tenant_option->count(); ++i) {
+    add_tenant(tenant_option->value(i));
+  }
+
+  // Token dictionaries are matched over 16 or 32-bit symbols by the compressed engine specialized for them, inputs
+  // are raw arrays of symbols in host byte order
+  std::optional<matching::token_automaton<std::uint16_t>> tokens16;
+  std::optional<matching::token_automaton<std::uint32_t>> tokens32;
+  const bool tokens = tokens_option->is_set();
+  if (tokens) {
+    if (!tenants.empty() || patterns_option->is_set() || grep_option->is_set() || index_option->is_set() ||
+        numa_option->is_set() || icase_option->is_set() || class_option->is_set()) {
+      throw std::invalid_argument{"Tokens can't be used with --tenant, --patterns, --grep, --index, --numa, -i or -c"};
+    }
+    if (engine_option->value() != "auto" && engine_option->value() != "ac-compressed") {
+      throw std::invalid_argument{"Tokens run on the ac-compressed engine only"};
+    }
+
+    const auto load = [&](auto &dfa, auto symbol) {
+      const auto token_needles = matching::read_token_dictionary<decltype(symbol)>(dict_option->value());
+      if (token_needles.empty()) throw std::invalid_argument{"Dictionary is empty"};
+      dfa.emplace(token_needles.begin(), token_needles.end());
+      if (verbose_option->is_set()) {
+        std::cout << "Info: Token automaton: " << dfa->num_states() << " states, " << dfa->num_classes()
+                  << " classes, " << dfa->num_dense() << " dense states\n";
+      }
+    };
+
+    if (tokens_option->value() == 16) {
+      load(tokens16, std::uint16_t{});
+    } else if (tokens_option->value() == 32) {
+      load(tokens32, std::uint32_t{});
+    } else {
+      throw std::invalid_argument{"Symbols must have 16 or 32 bits"};
+    }
+  }
+
+  const auto verbose = verbose_option->is_set();
+  std::vector<std::string> needles;
+  if (!tenants.empty()) {
+    needles = tenants.merged();
+  } else if (!tokens) {
+    needles = matching::read_dictionary(dict_option->value());
+  }
+
+  auto classes = (icase_option->is_set() ? matching::byte_classes::case_insensitive()
+                                         : matching::byte_classes::identity());
+  for (unsigned i = 0; i < class_option->count(); ++i) {
+    classes.merge(class_option->value(i));
+  }
+
+  // Patterns compile into one DFA that every supported engine and the host check share. The lazy engine builds its
+  // states on demand instead, and the host check and stream boundaries get a lazy DFA of their own. Fixed-length
+  // patterns of bytes and `?` can also run as masked needles by FFT or direct comparison.
+  std::optional<matching::automaton> pattern_dfa;
+  std::optional<matching::lazy_dfa> host_lazy;
+  std::optional<matching::masked_needles> masked;
+  const bool lazy = (engine_option->value() == "lazy-dfa");
+  const bool wildcard = (engine_option->value() == "fft" || engine_option->value() == "compare");
+  if ((lazy || wildcard) && !patterns_option->is_set()) {
+    throw std::invalid_argument{"Engine " + engine_option->value() + " runs patterns only"};
+  }
+
+  if (!tenants.empty() && (patterns_option->is_set() || grep_option->is_set() || index_option->is_set())) {
+    throw std::invalid_argument{"Tenant dictionaries can't be used with --patterns, --grep or --index"};
+  }
+
+  if (patterns_option->is_set()) {
+    if (numa_option->is_set() || index_option->is_set()) {
+      throw std::invalid_argument{"Patterns can't be used with --numa or --index"};
+    }
+    const auto &name = engine_option->value();
+    if (name != "auto" && name != "ac" && name != matching::persistent_engine_name && !lazy && !wildcard) {
+      throw std::invalid_argument{"Patterns run on the ac, ac-persistent, lazy-dfa, fft and compare engines only"};
+    }
+  }
+
+  if ((lazy || wildcard) && grep_option->is_set()) {
+    throw std::invalid_argument{"Engine " + engine_option->value() + " doesn't support --grep"};
+  }
+  if (lazy) {
+    host_lazy.emplace(needles, classes, lazy_states_option->value());
+  } else if (wildcard) {
+    masked.emplace(needles, classes);
+  } else if (patterns_option->is_set()) {
+    matching::build_report report;
+    pattern_dfa.emplace(matching::compile_patterns(needles, classes, max_states_option->value(), &report));
+    if (verbose) {
+      std::cout << "Info: Pattern DFA: " << pattern_dfa->num_states() << " states, " << pattern_dfa->num_classes()
+                << " classes\n";
+      std::cout << "Info: Pattern build:\n" << report;
+    }
+  }
+
+  // The host reference is compiled on the pool while the device context and the engine are set up
+  auto &pool = clutils::default_thread_pool();
+  std::future<matching::compressed_automaton> reference_build;
+  if (host_option->is_set() && !patterns_option->is_set() && !tokens) {
+    reference_build = pool.submit([&] {
+      return matching::compressed_automaton{needles.begin(), needles.end(), classes};
+    });
+  }
+
+  const bool numa = numa_option->is_set();
+  const cl_device_type device_type = (cpu_option->is_set() || numa ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_GPU);
+  matching::device_context ctx{verbose, matching::parse_memory_mode(memory_option->value()), device_type};
+  std::unique_ptr<matching::engine> engine;
+  const matching::lazy_dfa_engine *lazy_engine = nullptr;
+  std::optional<matching::compressed_automaton> reference;
+
+  if (index_option->is_set()) {
+    if (icase_option->is_set() || class_option->is_set()) {
+      throw std::invalid_argument{"Index queries match exact bytes, byte classes can't be used"};
+    }
+
+    const auto index = matching::fm_index::load(index_option->value());
+    matching::fm_engine fm{ctx, index};
+    const auto result = fm.count(needles);
+
+    if (verbose) {
+      std::cout << "Info: Index of " << index.text_size() << " bytes takes " << fm.footprint() << " bytes\n";
+      if (result.time.has_pure()) std::cout << "Info: GPU pure time: " << result.time.pure.count() << " ms\n";
+      std::cout << "Info: GPU wall time: " << result.time.wall.count() << " ms\n";
+    }
+
+    if (host_option->is_set() && index.count(needles) != result.counts) {
+      throw std::runtime_error{"Host and device results differ"};
+    }
+
+    for (unsigned i = 0; i < result.counts.size(); ++i) {
+      std::cout << i << " " << result.counts[i] << "\n";
+    }
+    return EXIT_SUCCESS;
+  }
+
+  const auto build_engine = [&](std::string_view name, unsigned chunk_size) -> std::unique_ptr<matching::engine> {
+    if (tokens16) return std::make_unique<matching::token_engine<std::uint16_t>>(ctx, *tokens16, chunk_size);
+    if (tokens32) return std::make_unique<matching::token_engine<std::uint32_t>>(ctx, *tokens32, chunk_size);
+    if (lazy) {
+      auto built = std::make_unique<matching::lazy_dfa_engine>(
+          ctx, needles, classes, chunk_size, lazy_states_option->value()
+      );
+      lazy_engine = built.get();
+      return built;
+    }
+    if (masked) {
+      const auto method = matching::parse_wildcard_method(std::string{name});
+      auto built = std::make_unique<matching::wildcard_engine>(ctx, *masked, method);
+      if (verbose && built->fft_size()) std::cout << "Info: FFT size: " << built->fft_size() << "\n";
+      return built;
+    }
+    if (pattern_dfa) {
+      if (name == matching::persistent_engine_name) {
+        return std::make_unique<matching::persistent_engine>(ctx, *pattern_dfa, chunk_size);
+      }
+      return std::make_unique<matching::aho_corasick_engine>(ctx, *pattern_dfa, chunk_size);
+    }
+    if (numa) return std::make_unique<matching::numa_engine>(ctx, name, needles, classes, chunk_size);
+    matching::build_report report;
+    auto built = matching::make_engine(name, ctx, needles, classes, chunk_size, &report);
+    if (verbose && !report.phases.empty()) std::cout << "Info: Automaton build:\n" << report;
+    return built;
+  };
+
+  // The engine is planned for the first haystack and reused for all of the following ones
+  const auto make_engine = [&](std::string_view haystack) -> std::unique_ptr<matching::engine> {
+    // The planner models literal byte dictionaries, patterns and tokens always run on the chunked engines
+    if (engine_option->value() != "auto" || patterns_option->is_set() || tokens) {
+      return build_engine(engine_option->value(), matching::default_chunk_size);
+    }
+
+    matching::cost_model model;
+    if (model_option->is_set()) model.load(model_option->value());
+
+    const matching::dictionary_stats stats{needles.begin(), needles.end(), classes};
+    const matching::workload w{
+        stats, matching::device_stats{ctx.device()}, haystack.size(),
+        stats.match_probability(matching::sample_haystack(haystack))};
+    const auto plan = matching::make_plan(model, w);
+
+    if (verbose) {
+      std::cout << "Info: Dictionary: " << stats.num_needles << " needles, " << stats.num_states << " states, "
+                << stats.num_classes << " classes, mean length " << stats.mean_length << ", entropy "
+                << stats.entropy << " bits\n";
+      std::cout << "Info: Plan: " << plan << "\n";
+    }
+
+    return build_engine(plan.engine, plan.chunk_size);
+  };
+
+  const auto host_reference = [&]() -> const matching::compressed_automaton & {
+    if (!reference) reference.emplace(pool.wait(reference_build));
+    return *reference;
+  };
+
+  // Grep mode runs the line matcher instead of an engine, the other output options keep working the same way
+  std::unique_ptr<matching::line_matcher> line_matcher;
+  const auto process_lines = [&](std::string_view haystack, const std::string *name) {
+    if (!line_matcher && pattern_dfa) line_matcher = std::make_unique<matching::line_matcher>(ctx, *pattern_dfa);
+    if (!line_matcher) {
+      matching::build_report report;
+      line_matcher = std::make_unique<matching::line_matcher>(
+          ctx, matching::automaton{needles.begin(), needles.end(), classes, &report}
+      );
+      if (verbose) std::cout << "Info: Automaton build:\n" << report;
+    }
+
+    const auto hits = line_matcher->match(haystack);
+
+    if (host_option->is_set()) {
+      const auto expected = (pattern_dfa ? matching::host_matching_lines(*pattern_dfa, haystack)
+                                         : matching::host_matching_lines(host_reference(), haystack));
+      const auto same = [](const auto &a, const auto &b) { return a.line == b.line && a.position == b.position; };
+      if (!std::equal(hits.begin(), hits.end(), expected.begin(), expected.end(), same)) {
+        throw std::runtime_error{"Host and device results differ"};
+      }
+    }
+
+    if (files_option->is_set()) {
+      const auto &inputs = op.non_option_args();
+      if (!hits.empty()) std::cout << (name ? *name : (inputs.empty() ? "(standard input)" : inputs.front())) << "\n";
+      return;
+    }
+
+    const auto prefix = (name ? *name + ":" : std::string{});
+    if (count_lines_option->is_set()) {
+      std::cout << prefix << hits.size() << "\n";
+      return;
+    }
+
+    for (const auto &hit : hits) {
+      std::cout << prefix << hit.line + 1 << ":" << matching::line_at(haystack, hit.position) << "\n";
+    }
+  };
+
+  // Matches one haystack, or one chunk of a stream, and checks it against the host when asked to
+  const auto match = [&](std::string_view haystack) {
+    if (!engine) engine = make_engine(haystack);
+    auto result = engine->match(haystack);
+
+    if (host_option->is_set()) {
+      const auto expected = (lazy          ? host_lazy->count(haystack)
+                             : tokens16    ? tokens16->count(haystack)
+                             : tokens32    ? tokens32->count(haystack)
+                             : masked      ? matching::parallel_count(*masked, haystack)
+                             : pattern_dfa ? matching::parallel_count(*pattern_dfa, haystack)
+                                           : matching::parallel_count(host_reference(), haystack));
+      if (expected != result.counts) {
+        throw std::runtime_error{"Host and device results differ"};
+      }
+    }
+
+    return result;
+  };
+
+  const auto print_counts = [&](const matching::match_result &result, const std::string *name) {
+    if (verbose) {
+      std::cout << "Info: Engine " << engine->name() << " automaton takes " << engine->footprint() << " bytes\n";
+      if (result.time.has_pure()) std::cout << "Info: GPU pure time: " << result.time.pure.count() << " ms\n";
+      std::cout << "Info: GPU wall time: " << result.time.wall.count() << " ms\n";
+      if (lazy_engine) std::cout << "Info: Lazy DFA: " << lazy_engine->stats() << "\n";
+    }
+
+    if (name) std::cout << "# " << *name << "\n";
+    if (!tenants.empty()) {
+      for (const auto &[tenant, counts] : tenants.demultiplex(result.counts)) {
+        std::cout << "## " << tenants.name(tenant) << "\n";
+        for (unsigned i = 0; i < counts.size(); ++i) {
+          std::cout << i << " " << counts[i] << "\n";
+        }
+      }
+      return;
+    }
+
+    for (unsigned i = 0; i < result.counts.size(); ++i) {
+      std::cout << i << " " << result.counts[i] << "\n";
+    }
+  };
+
+  const auto process = [&](std::string_view haystack, const std::string *name) {
+    if (grep_option->is_set()) return process_lines(haystack, name);
+    print_counts(match(haystack), name);
+  };
+
+  // Compressed inputs are decoded on host threads into reused pinned chunks while the device matches the previous
+  // chunk. Grep mode needs the line numbers of the whole input and token inputs can't be cut at arbitrary bytes, so
+  // both decode it into one buffer instead.
+  std::optional<matching::compressed_automaton> boundary;
+  const auto chunk_size = std::size_t{std::max(stream_chunk_option->value(), 1u)} << 20;
+  const auto process_path = [&](const std::string &path, const std::string *name) {
+    // The input is opened once and its format told from that stream, so that pipes keep their first bytes
+    matching::input_file input{path};
+    if (input.format() == matching::compression::none) {
+      if (auto *cache = ctx.residency()) {
+        if (const auto resident = cache->acquire(path)) return process(*resident, name);
+      }
+      const auto buffer = input.read_all(ctx.make_pinned_buffer());
+      return process({buffer.data(), buffer.size()}, name);
+    }
+
+    matching::decompressing_reader reader{std::move(input), pool};
+    if (grep_option->is_set() || tokens) {
+      const auto buffer = matching::read_stream(reader, ctx.make_pinned_buffer());
+      return process({buffer.data(), buffer.size()}, name);
+    }
+
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+    auto chunk = ctx.make_pinned_buffer();
+    matching::match_result total{};
+    const auto match_part = [&](std::string_view part) {
+      auto result = match(part);
+      total.time.pure += result.time.pure;
+      return result.counts;
+    };
+
+    if (host_lazy) {
+      total.counts = matching::match_stream(reader, chunk, chunk_size, *host_lazy, match_part);
+    } else if (masked) {
+      total.counts = matching::match_stream(reader, chunk, chunk_size, *masked, match_part);
+    } else if (pattern_dfa) {
+      total.counts = matching::match_stream(reader, chunk, chunk_size, *pattern_dfa, match_part);
+    } else {
+      if (!boundary) boundary.emplace(needles.begin(), needles.end(), classes);
+      total.counts = matching::match_stream(reader, chunk, chunk_size, *boundary, match_part);
+    }
+
+    total.time.wall = matching::to_millis(std::chrono::high_resolution_clock::now() - wall_start);
+    print_counts(total, name);
+  };
+
+  // A tenant change rebuilds everything compiled from the merged dictionary on the next job; the other tenants keep
+  // their ids and needle indices. A failed command leaves the tenants as they were.
+  const auto change_tenants = [&](const std::string &command) {
+    if (tenants.empty()) throw std::invalid_argument{"Tenant commands need tenant dictionaries"};
+    if (command.starts_with(":add ")) {
+      add_tenant(command.substr(5));
+    } else if (command.starts_with(":drop ")) {
+      if (tenants.size() == 1) throw std::invalid_argument{"Last tenant can't be dropped"};
+      tenants.drop(command.substr(6));
+    } else {
+      throw std::invalid_argument{"Unknown command " + command};
+    }
+
+    // The reference build reads the needles, so it has to finish before they change
+    if (reference_build.valid()) pool.wait(reference_build);
+    needles = tenants.merged();
+    engine.reset();
+    boundary.reset();
+    reference.reset();
+    if (host_option->is_set()) {
+      reference_build = pool.submit([&] {
+        return matching::compressed_automaton{needles.begin(), needles.end(), classes};
+      });
+    }
+    if (verbose) std::cout << "Info: Tenants: " << tenants.size() << ", needles: " << needles.size() << "\n";
+  };
+
+  const auto &inputs = op.non_option_args();
+  if (daemon_option->is_set()) {
+    // Jobs often come back to the same corpus with another dictionary, so haystacks stay on the device between them
+    ctx.enable_residency(std::size_t{cache_option->value()} << 20);
+    // Lines starting with ':' are commands, a haystack whose name starts with ':' is given as ./:name. A failed line
+    // is reported and the daemon goes on with the next one.
+    for (std::string path; std::getline(std::cin, path);) {
+      if (path.empty()) continue;
+      try {
+        if (path.front() == ':') {
+          change_tenants(path);
+          continue;
+        }
+        process_path(path, &path);
+        if (verbose) std::cout << "Info: Resident haystacks: " << ctx.residency()->stats() << "\n";
+      } catch (std::exception &e) {
+        std::cerr << "Error: " << path << ": " << e.what() << "\n";
+      }
+      std::cout << std::flush;
+    }
+  } else if (inputs.empty()) {
+    const auto buffer = matching::read_haystack(std::cin, ctx.make_pinned_buffer());
+    process({buffer.data(), buffer.size()}, nullptr);
+  } else {
+    for (const auto &path : inputs) {
+      process_path(path, (inputs.size() > 1 ? &path : nullptr));
+    }
+  }
+
+  if (verbose) std::cout << "Info: Buffer pool: " << ctx.pool().stats() << "\n";
+} catch (cl::Error &e) {
+  std::cerr << "OpenCL error: " << e.what() << "\n";
+  return EXIT_FAILURE;
+} catch (std::exception &e) {
+  std::cerr << "Encountered error: " << e.what() << "\n";
+  return EXIT_FAILURE;
+} catch (...) {
+  std::cerr << "Unknown error\n";
+  return EXIT_FAILURE;
+}
@@ -11,13 +11,26 @@
 #include "common/opencl_include.hpp"
 #include "common/selector.hpp"
 
+#include "kernelhpp/microbench_kernel.hpp"
+
+#include "popl.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
 #include <exception>
+#include <fstream>
 #include <ios>
 #include <iostream>
+#include <limits>
 #include <ostream>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 static const auto print_delim = [](auto &os) { os << " -------- \n"; };
 
@@ -33,6 +46,41 @@ std::string get_device_type_string(int type) {
   return found->second;
 }
 
+std::string get_partition_properties_string(const std::vector<cl_device_partition_property> &properties) {
+  static const std::unordered_map<cl_device_partition_property, std::string> property_map = {
+      {CL_DEVICE_PARTITION_EQUALLY,            "CL_DEVICE_PARTITION_EQUALLY"           },
+      {CL_DEVICE_PARTITION_BY_COUNTS,          "CL_DEVICE_PARTITION_BY_COUNTS"         },
+      {CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, "CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN"}
+  };
+
+  std::string result;
+  for (auto property : properties) {
+    auto found = property_map.find(property);
+    if (found == property_map.end()) continue;
+    result += (result.empty() ? "" : ", ") + found->second;
+  }
+
+  return (result.empty() ? "none" : result);
+}
+
+std::string get_affinity_domains_string(cl_device_affinity_domain domains) {
+  static const std::vector<std::pair<cl_device_affinity_domain, std::string>> domain_names = {
+      {CL_DEVICE_AFFINITY_DOMAIN_NUMA,               "NUMA"              },
+      {CL_DEVICE_AFFINITY_DOMAIN_L4_CACHE,           "L4_CACHE"          },
+      {CL_DEVICE_AFFINITY_DOMAIN_L3_CACHE,           "L3_CACHE"          },
+      {CL_DEVICE_AFFINITY_DOMAIN_L2_CACHE,           "L2_CACHE"          },
+      {CL_DEVICE_AFFINITY_DOMAIN_L1_CACHE,           "L1_CACHE"          },
+      {CL_DEVICE_AFFINITY_DOMAIN_NEXT_PARTITIONABLE, "NEXT_PARTITIONABLE"}
+  };
+
+  std::string result;
+  for (const auto &[domain, name] : domain_names) {
+    if (domains & domain) result += (result.empty() ? "" : ", ") + name;
+  }
+
+  return (result.empty() ? "none" : result);
+}
+
 void display_device_info(cl::Device &dev, std::ostream &os) {
   os << "  Name: " << dev.getInfo<CL_DEVICE_NAME>() << "\n";
   os << "  Type: " << get_device_type_string(dev.getInfo<CL_DEVICE_TYPE>()) << "\n";
@@ -59,6 +107,12 @@ void display_device_info(cl::Device &dev, std::ostream &os) {
   os << "  Native vector width of float: " << dev.getInfo<CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT>() << "\n";
   os << "  Native vector width of half: " << dev.getInfo<CL_DEVICE_NATIVE_VECTOR_WIDTH_HALF>() << "\n";
   os << "  Native vector width of double: " << dev.getInfo<CL_DEVICE_NATIVE_VECTOR_WIDTH_DOUBLE>() << "\n";
+
+  os << "  Partition properties: " << get_partition_properties_string(dev.getInfo<CL_DEVICE_PARTITION_PROPERTIES>())
+     << "\n";
+  os << "  Partition affinity domains: "
+     << get_affinity_domains_string(dev.getInfo<CL_DEVICE_PARTITION_AFFINITY_DOMAIN>()) << "\n";
+  os << "  Max sub-devices: " << dev.getInfo<CL_DEVICE_PARTITION_MAX_SUB_DEVICES>() << "\n";
 }
 
 void display_platform_info(cl::Platform &plat, std::ostream &os) {
@@ -96,10 +150,220 @@ void display_info(std::ostream &os) {
   }
 }
 
-int main() try { display_info(std::cout); } catch (cl::Error &e) {
+std::string json_string(const std::string &str) {
+  std::string result = "\"";
+  for (const char c : str) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (static_cast<unsigned char>(c) >= 0x20) {
+      result += c;
+    }
+  }
+  return result + "\"";
+}
+
+// Best of several runs, in seconds
+template <typename F> double best_wall_time(unsigned repeats, F run) {
+  double best = std::numeric_limits<double>::max();
+  for (unsigned i = 0; i < repeats; ++i) {
+    const auto start = std::chrono::high_resolution_clock::now();
+    run();
+    const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    best = std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+cl::Event
+enqueue(const cl::CommandQueue &queue, cl::Kernel &kernel, cl::NDRange global, cl::NDRange local = cl::NullRange) {
+  cl::Event event;
+  queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, local, nullptr, &event);
+  return event;
+}
+
+template <typename F> double best_kernel_time(unsigned repeats, F launch) {
+  double best = std::numeric_limits<double>::max();
+  for (unsigned i = 0; i < repeats; ++i) {
+    const cl::Event event = launch();
+    event.wait();
+    const auto ns = event.getProfilingInfo<CL_PROFILING_COMMAND_END>() -
+                    event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+    best = std::min(best, static_cast<double>(ns) * 1e-9);
+  }
+  return best;
+}
+
+// What matching actually gets out of the device: transfer bandwidth in both directions from pageable and pinned host
+// memory, global and local memory read bandwidth, the round trip of an empty kernel and atomic increments per second.
+// Bandwidths are in GB/s.
+void bench_device(const cl::Platform &plat, const cl::Device &dev, std::ostream &os) {
+  constexpr unsigned repeats = 5, launches = 200, local_iterations = 4096, atomic_iterations = 256;
+
+  cl::Context context{dev};
+  cl::CommandQueue queue{context, dev, CL_QUEUE_PROFILING_ENABLE};
+  cl::Program program{context, microbench_kernel::source()};
+  try {
+    program.build(std::vector<cl::Device>{dev});
+  } catch (cl::Error &e) {
+    std::cerr << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(dev) << "\n";
+    throw;
+  }
+
+  const std::size_t size =
+      std::min<std::size_t>(std::size_t{64} << 20, dev.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>() / 2) / 16 * 16;
+  const auto gbps = [](std::size_t bytes, double seconds) { return static_cast<double>(bytes) / seconds * 1e-9; };
+
+  cl::Buffer device_buf{context, CL_MEM_READ_WRITE, size};
+  std::vector<char> pageable(size, 1);
+  cl::Buffer pinned_buf{context, CL_MEM_ALLOC_HOST_PTR, size};
+  auto *pinned = static_cast<char *>(queue.enqueueMapBuffer(pinned_buf, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size));
+  std::fill(pinned, pinned + size, 1);
+
+  const auto transfer = [&](bool write, char *host) {
+    return gbps(size, best_wall_time(repeats, [&] {
+                  if (write) {
+                    queue.enqueueWriteBuffer(device_buf, CL_TRUE, 0, size, host);
+                  } else {
+                    queue.enqueueReadBuffer(device_buf, CL_TRUE, 0, size, host);
+                  }
+                }));
+  };
+
+  const double h2d_pageable = transfer(true, pageable.data()), d2h_pageable = transfer(false, pageable.data());
+  const double h2d_pinned = transfer(true, pinned), d2h_pinned = transfer(false, pinned);
+  queue.enqueueUnmapMemObject(pinned_buf, pinned);
+
+  const std::size_t compute_units = dev.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+  const std::size_t group_size = std::min<std::size_t>(256, dev.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>());
+  const std::size_t global_size = std::min<std::size_t>(compute_units * group_size * 4, size / 16);
+  cl::Buffer out_buf{context, CL_MEM_READ_WRITE, global_size * sizeof(cl_uint)};
+
+  cl::Kernel read_global{program, "read_global"};
+  read_global.setArg(0, device_buf);
+  read_global.setArg(1, static_cast<cl_uint>(size / 16));
+  read_global.setArg(2, out_buf);
+  const double global_read =
+      gbps(size, best_kernel_time(repeats, [&] { return enqueue(queue, read_global, cl::NDRange{global_size}); }));
+
+  cl::Kernel read_local{program, "read_local"};
+  const auto local_size =
+      std::min<std::size_t>(group_size, read_local.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(dev));
+  const auto local_global_size = global_size / local_size * local_size;
+  read_local.setArg(0, out_buf);
+  read_local.setArg(1, static_cast<cl_uint>(local_iterations));
+  read_local.setArg(2, cl::Local(local_size * sizeof(cl_uint4)));
+  const double local_read = gbps(
+      local_global_size * local_iterations * sizeof(cl_uint4), best_kernel_time(repeats, [&] {
+        return enqueue(queue, read_local, cl::NDRange{local_global_size}, cl::NDRange{local_size});
+      })
+  );
+
+  cl::Kernel empty{program, "empty"};
+  queue.enqueueNDRangeKernel(empty, cl::NullRange, cl::NDRange{1});
+  queue.finish();
+  const auto launch_start = std::chrono::high_resolution_clock::now();
+  for (unsigned i = 0; i < launches; ++i) {
+    queue.enqueueNDRangeKernel(empty, cl::NullRange, cl::NDRange{1});
+    queue.finish();
+  }
+  const std::chrono::duration<double, std::micro> launch_time =
+      std::chrono::high_resolution_clock::now() - launch_start;
+
+  cl::Kernel increment{program, "increment"};
+  const auto atomics = [&](std::size_t num_counters) {
+    increment.setArg(0, out_buf);
+    increment.setArg(1, static_cast<cl_uint>(num_counters));
+    increment.setArg(2, static_cast<cl_uint>(atomic_iterations));
+    const auto seconds =
+        best_kernel_time(repeats, [&] { return enqueue(queue, increment, cl::NDRange{global_size}); });
+    return static_cast<double>(global_size * atomic_iterations) / seconds;
+  };
+  const double contended_atomics = atomics(1), spread_atomics = atomics(global_size);
+
+  os << "    {\n";
+  os << "      \"platform\": " << json_string(plat.getInfo<CL_PLATFORM_NAME>()) << ",\n";
+  os << "      \"device\": " << json_string(dev.getInfo<CL_DEVICE_NAME>()) << ",\n";
+  os << "      \"type\": " << json_string(get_device_type_string(dev.getInfo<CL_DEVICE_TYPE>())) << ",\n";
+  os << "      \"transfer_bytes\": " << size << ",\n";
+  os << "      \"h2d_pageable_gbps\": " << h2d_pageable << ",\n";
+  os << "      \"d2h_pageable_gbps\": " << d2h_pageable << ",\n";
+  os << "      \"h2d_pinned_gbps\": " << h2d_pinned << ",\n";
+  os << "      \"d2h_pinned_gbps\": " << d2h_pinned << ",\n";
+  os << "      \"global_read_gbps\": " << global_read << ",\n";
+  os << "      \"local_read_gbps\": " << local_read << ",\n";
+  os << "      \"launch_latency_us\": " << launch_time.count() / launches << ",\n";
+  os << "      \"contended_atomics_per_s\": " << contended_atomics << ",\n";
+  os << "      \"spread_atomics_per_s\": " << spread_atomics << "\n";
+  os << "    }";
+}
+
+// One JSON object per device of every platform. A device that fails is reported with its error and the rest are
+// still measured.
+void bench_all(std::ostream &os) {
+  std::vector<cl::Platform> platforms;
+  cl::Platform::get(&platforms);
+
+  os << "{\n  \"devices\": [\n";
+  bool first = true;
+  for (auto &plat : platforms) {
+    std::vector<cl::Device> devices;
+    plat.getDevices(CL_DEVICE_TYPE_ALL, &devices);
+
+    for (auto &dev : devices) {
+      os << (first ? "" : ",\n");
+      first = false;
+
+      std::ostringstream entry;
+      try {
+        bench_device(plat, dev, entry);
+        os << entry.str();
+      } catch (cl::Error &e) {
+        os << "    {\n      \"platform\": " << json_string(plat.getInfo<CL_PLATFORM_NAME>())
+           << ",\n      \"device\": " << json_string(dev.getInfo<CL_DEVICE_NAME>()) << ",\n      \"error\": "
+           << json_string(std::string{e.what()} + " (" + std::to_string(e.err()) + ")") << "\n    }";
+      }
+    }
+  }
+  os << "\n  ]\n}\n";
+}
+
+int main(int argc, char **argv) try {
+  popl::OptionParser op("Allowed options");
+
+  auto help_option = op.add<popl::Switch>("h", "help", "Print this help message");
+  auto bench_option = op.add<popl::Switch>(
+      "b", "bench", "Measure transfer and memory bandwidth, launch latency and atomics of every device, as JSON"
+  );
+  auto output_option = op.add<popl::Value<std::string>>("o", "output", "Write the benchmark results to a file");
+
+  op.parse(argc, argv);
+
+  if (help_option->is_set()) {
+    std::cout << op << "\n";
+    return EXIT_SUCCESS;
+  }
+
+  if (!bench_option->is_set()) {
+    display_info(std::cout);
+    return EXIT_SUCCESS;
+  }
+
+  if (!output_option->is_set()) {
+    bench_all(std::cout);
+    return EXIT_SUCCESS;
+  }
+
+  std::ofstream os{output_option->value()};
+  if (!os) throw std::runtime_error{"Can't open output file " + output_option->value()};
+  bench_all(os);
+} catch (cl::Error &e) {
   std::cerr << "OpenCL error: " << e.what() << "\n";
+  return EXIT_FAILURE;
 } catch (std::exception &e) {
   std::cerr << "Encountered error: " << e.what() << "\n";
+  return EXIT_FAILURE;
 } catch (...) {
   std::cerr << "Unknown error\n";
+  return EXIT_FAILURE;
 }
\ No newline at end of file